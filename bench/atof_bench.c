@@ -0,0 +1,87 @@
+/*
+ * Times parse_decimal() against atof() over a corpus of quote-like
+ * strings, one per line, and checks that both agree on every line.
+ *
+ * Build it next to the library sources, e.g.
+ *     cl /O2 /I.. atof_bench.c blpapi3_32.lib libcollections.lib
+ *     atof_bench atof_corpus.txt
+ */
+#include "../libblp.c"
+
+#define BENCH_MAX_LINES    (64 * 1024)
+#define BENCH_LINE_LENGTH  32
+#define BENCH_ROUNDS       400
+
+static char corpus[ BENCH_MAX_LINES ][ BENCH_LINE_LENGTH ];
+
+int main( int argc, char *argv[] )
+{
+	const char *filename = argc > 1 ? argv[ 1 ] : "atof_corpus.txt";
+	FILE *file           = fopen( filename, "r" );
+	size_t count         = 0;
+	size_t mismatches    = 0;
+	double sum           = 0.0;
+	double atof_seconds;
+	double parse_seconds;
+	clock_t start;
+	size_t i;
+	int round;
+
+	if( !file )
+	{
+		fprintf( stderr, "Unable to open %s\n", filename );
+		return 1;
+	}
+
+	while( count < BENCH_MAX_LINES && fgets( corpus[ count ], BENCH_LINE_LENGTH, file ) )
+	{
+		corpus[ count ][ strcspn( corpus[ count ], "\r\n" ) ] = '\0';
+
+		if( corpus[ count ][ 0 ] != '\0' )
+		{
+			count++;
+		}
+	}
+
+	fclose( file );
+
+	for( i = 0; i < count; i++ )
+	{
+		double value;
+
+		if( !parse_decimal( corpus[ i ], &value ) || value != strtod( corpus[ i ], NULL ) )
+		{
+			printf( "mismatch: %s\n", corpus[ i ] );
+			mismatches++;
+		}
+	}
+
+	start = clock( );
+	for( round = 0; round < BENCH_ROUNDS; round++ )
+	{
+		for( i = 0; i < count; i++ )
+		{
+			sum += atof( corpus[ i ] );
+		}
+	}
+	atof_seconds = (double) (clock( ) - start) / CLOCKS_PER_SEC;
+
+	start = clock( );
+	for( round = 0; round < BENCH_ROUNDS; round++ )
+	{
+		for( i = 0; i < count; i++ )
+		{
+			double value = 0.0;
+
+			parse_decimal( corpus[ i ], &value );
+			sum += value;
+		}
+	}
+	parse_seconds = (double) (clock( ) - start) / CLOCKS_PER_SEC;
+
+	printf( "%lu strings, %d rounds (checksum %g)\n", (unsigned long) count, BENCH_ROUNDS, sum );
+	printf( "  atof           %6.1f ns/op\n", atof_seconds * 1e9 / ((double) count * BENCH_ROUNDS) );
+	printf( "  parse_decimal  %6.1f ns/op\n", parse_seconds * 1e9 / ((double) count * BENCH_ROUNDS) );
+	printf( "  mismatches     %lu\n", (unsigned long) mismatches );
+	return mismatches ? 1 : 0;
+}
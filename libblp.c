@@ -22,16 +22,22 @@
 #include <blpapi_correlationid.h>
 #include <blpapi_event.h>
 #include <blpapi_message.h>
+#include <blpapi_name.h>
 #include <blpapi_request.h>
 #include <blpapi_session.h>
 #include <blpapi_service.h>
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 #include <assert.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
 
 #include <hash-map.h>
 #include <hash-functions.h>
@@ -42,16 +48,93 @@
 #include <windows.h>
 #define ACQUIRE_LOCK( p_obj )  			EnterCriticalSection( (LPCRITICAL_SECTION) &p_obj->crit_section );
 #define RELEASE_LOCK( p_obj )  			LeaveCriticalSection( (LPCRITICAL_SECTION) &p_obj->crit_section );
+#define THREAD_LOCAL                    __declspec( thread )
+#define ATOMIC_EXCHANGE_POINTER( p_target, p_value )  InterlockedExchangePointer( (void* volatile*) (p_target), (p_value) )
+#define ATOMIC_COMPARE_EXCHANGE_POINTER( p_target, p_value, p_comparand )  InterlockedCompareExchangePointer( (void* volatile*) (p_target), (p_value), (p_comparand) )
+#define ATOMIC_INCREMENT( p_value )     InterlockedIncrement( (p_value) )
+#define ATOMIC_COMPARE_EXCHANGE( p_target, value, comparand )  InterlockedCompareExchange( (p_target), (value), (comparand) )
+#define ATOMIC_LOAD( p_value )          (*(p_value))
+#define ATOMIC_STORE( p_target, value ) InterlockedExchange( (p_target), (value) )
+#define ATOMIC_DECREMENT( p_value )     InterlockedDecrement( (p_value) )
+#define SPIN_LOCK( p_lock )             while( InterlockedCompareExchange( (p_lock), 1, 0 ) != 0 ) { }
+#define SPIN_UNLOCK( p_lock )           InterlockedExchange( (p_lock), 0 );
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define THREAD_LOCAL                    __thread
+#define ATOMIC_EXCHANGE_POINTER( p_target, p_value )  __sync_lock_test_and_set( (p_target), (p_value) )
+#define ATOMIC_COMPARE_EXCHANGE_POINTER( p_target, p_value, p_comparand )  __sync_val_compare_and_swap( (p_target), (p_comparand), (p_value) )
+#define ATOMIC_INCREMENT( p_value )     __sync_add_and_fetch( (p_value), 1 )
+#define ATOMIC_COMPARE_EXCHANGE( p_target, value, comparand )  __sync_val_compare_and_swap( (p_target), (comparand), (value) )
+#define ATOMIC_LOAD( p_value )          __atomic_load_n( (p_value), __ATOMIC_ACQUIRE )
+#define ATOMIC_STORE( p_target, value ) __atomic_store_n( (p_target), (value), __ATOMIC_RELEASE )
+#define ATOMIC_DECREMENT( p_value )     __sync_sub_and_fetch( (p_value), 1 )
+#define SPIN_LOCK( p_lock )             while( __sync_lock_test_and_set( (p_lock), 1 ) ) { }
+#define SPIN_UNLOCK( p_lock )           __sync_lock_release( (p_lock) );
+#endif
+
+/* AVX2 column kernels are built on x86 and only used if the CPU has AVX2. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BLP_COLUMN_AVX2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2                     __attribute__(( target( "avx2" ) ))
+#endif
 #endif
 
 #define FIELDS_TABLE_SMALL   13
 #define FIELDS_TABLE_MEDIUM  23
 #define FIELDS_TABLE_LARGE   37
 
+#define ARENA_ALIGNMENT              8
+#define ARENA_ALIGN( size )          (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+#define SECURITY_ARENA_FIELD_BLOCK   (4 * 1024)
+#define SECURITY_ARENA_STRING_BLOCK  (16 * 1024)
+#define SECURITY_ARENA_COMPACT_MIN   (64 * 1024)
+#define FIELD_INLINE_CAPACITY        16   /* strings shorter than this live in field_t */
+#define FIELD_TYPE_INTERNED          0x80 /* storage type of strings kept in the value pool */
+#define VALUE_POOL_BLOCK             (16 * 1024)
+
+/*
+ * Bump allocator. Nothing is freed on its own; every block goes back to
+ * the heap at once in arena_destroy().
+ */
+typedef struct arena_block {
+	struct arena_block* next;
+	size_t              size;
+	size_t              used;
+} arena_block_t;
+
+typedef struct arena {
+	arena_block_t* blocks;      /* the block being filled comes first */
+	size_t         block_size;
+	size_t         allocated;   /* bytes handed out, including alignment */
+} arena_t;
+
+/*
+ * field_t structures are never freed before their security, so they come
+ * from one arena. String values churn with every update and come from a
+ * second one that is compacted once most of it is dead.
+ */
+typedef struct security_arena {
+	arena_t fields;
+	arena_t strings;
+	size_t  compact_at;
+} security_arena_t;
+
 struct blp {
 	unsigned short error_num;
 	boolean debug;
 	blpapi_SessionOptions_t *session_options;
+	size_t dispatcher_threads;             /* 0 uses the session's own dispatcher */
+	unsigned long long dispatcher_affinity; /* CPU mask for dispatcher threads, 0 for none */
 };
 
 struct security {
@@ -59,6 +142,15 @@ struct security {
 	hash_map_t          fields;
 	tree_map_t          overrides;
 	char*               ticker;
+	boolean             is_lazy;
+	boolean             is_fixed_point;
+	security_arena_t*   p_arena;      /* NULL when fields come from the heap */
+	blp_version_t       version;      /* bumped by every field update */
+	security_snapshot_t* p_snapshot;  /* latest snapshot, shared until a field changes */
+	universe_table_t*   p_universe;   /* table fed by market data, or NULL */
+	size_t              universe_row;
+	alert_engine_t*     p_alerts;     /* engine fed by market data, or NULL */
+	struct alert_security* p_alert_security; /* this ticker's triggers in p_alerts */
 
 	#if defined(WIN32) || defined(WIN64)
     CRITICAL_SECTION crit_section;
@@ -88,32 +180,557 @@ static const char *SERVICES[] = {
 };
 
 
+/*
+ * In lazy mode an update only copies the wire string into raw (reusing its
+ * buffer) and marks the field pending; it is converted into value the
+ * next time somebody reads the field.
+ *
+ * value_storage says who owns a string value. Short strings sit in
+ * inline_value, so most updates of codes and flags allocate nothing.
+ */
+typedef enum field_storage {
+	FIELD_STORAGE_HEAP,
+	FIELD_STORAGE_ARENA,
+	FIELD_STORAGE_INLINE,
+	FIELD_STORAGE_INTERNED
+} field_storage_t;
+
 struct field {
-	variant_t   value;
+	variant_t     value;
+	unsigned char type;          /* storage type chosen when the value was written */
+	unsigned char scale;         /* decimal places of fixed, for BLP_FIELD_TYPE_FIXED */
+	long long     fixed;         /* exact scaled price; value.decimal mirrors it */
+	boolean       is_pending;    /* raw holds a newer value than value */
+	unsigned char value_storage; /* field_storage_t of a string value */
+	blp_version_t version;       /* security version of the last update */
+	blp_value_code_t code;       /* pool code, for FIELD_STORAGE_INTERNED */
+	char          inline_value[ FIELD_INLINE_CAPACITY ];
+	char*         raw;
+	size_t        raw_capacity;
+};
+
+/*
+ * A field update read from a market data message, waiting to be applied
+ * together with the rest of the message.
+ */
+typedef struct staged_field {
+	const char*   field;         /* canonical field key */
+	unsigned char type;
+	unsigned char scale;
+	const char*   string;        /* text value, owned by the message */
+	field_t       update;        /* converted value when string is NULL */
+} staged_field_t;
+
+#define STAGED_FIELDS_LOCAL   32   /* staged on the stack before falling back to the heap */
+
+/*
+ * A universe table keeps one numeric field of every security in a column,
+ * a row per security, so cross-sectional scans walk contiguous memory.
+ * Rows are allocated up front and never move, which lets readers scan a
+ * column without a lock; a row vacated by a security is reused. The
+ * ticker of a vacated row is kept until the table is destroyed, since a
+ * reader may still hold it.
+ */
+typedef struct universe_ticker {
+	struct universe_ticker* next;     /* on the retired list */
+	char                    text[ 1 ];
+} universe_ticker_t;
+
+struct universe_table {
+	size_t              column_count;
+	blp_field_id_t*     ids;
+	const char**        keys;            /* canonical key of each column */
+	size_t              row_capacity;
+	size_t              row_count;       /* rows handed out so far, the scan length */
+	universe_ticker_t** tickers;         /* NULL for a free row */
+	universe_ticker_t*  retired;         /* tickers of vacated rows */
+	double*             values;          /* column after column, row_capacity apiece */
+	unsigned char*      validity;        /* a bit per row, column after column */
+	size_t              validity_stride; /* bytes of validity per column */
+	volatile long       lock;            /* guards row allocation and validity */
+};
+
+/*
+ * Column kernels reduce a universe column, optionally restricted to the
+ * rows set in a validity bitmap. Each comes in a portable version and an
+ * AVX2 version; the AVX2 ones are picked once, at first use, when the CPU
+ * and the operating system support them.
+ */
+typedef struct column_kernels {
+	size_t (*sum)     ( const double *values, const unsigned char *validity, size_t count, double *p_sum );
+	double (*squares) ( const double *values, const unsigned char *validity, size_t count, double mean );
+	size_t (*min_max) ( const double *values, const unsigned char *validity, size_t count, double *p_min, double *p_max );
+} column_kernels_t;
+
+#define COLUMN_IS_VALID( validity, i )   (((validity)[ (i) / 8 ] >> ((i) % 8)) & 1)
+
+static const column_kernels_t* volatile active_column_kernels = NULL;
+
+/*
+ * The alert engine keeps, for every ticker and field with triggers, the
+ * thresholds sorted in two arrays: those fired by a rise through them
+ * and those fired by a fall. An update from p to v fires the rising
+ * thresholds in [p, v) or the falling ones in (v, p], found by binary
+ * search. Fired alerts go into a bounded lock-free queue.
+ *
+ * A removed trigger's registration slot goes on a free list and is
+ * reused. An id carries the slot in its low bits and the slot's
+ * generation above them, so the id of a removed trigger stays invalid
+ * after its slot has been handed out again.
+ */
+#define ALERT_SLOT_BITS        20
+#define ALERT_SLOT_MASK        ((1u << ALERT_SLOT_BITS) - 1)
+#define ALERT_SLOT_MAX         ((size_t) ALERT_SLOT_MASK)  /* slot + 1 has to fit, 0 is BLP_ALERT_ID_NONE */
+#define ALERT_GENERATION_MASK  ((1u << (32 - ALERT_SLOT_BITS)) - 1)
+#define ALERT_ID( slot, generation )  ((blp_alert_id_t) ((((generation) & ALERT_GENERATION_MASK) << ALERT_SLOT_BITS) | ((slot) + 1)))
+
+typedef struct alert_threshold {
+	double         threshold;
+	blp_alert_id_t id;
+	unsigned char  kind;
+	void*          context;
+} alert_threshold_t;
+
+typedef struct alert_index {
+	const char*        key;          /* canonical field key */
+	double             last;
+	boolean            has_last;
+	alert_threshold_t* rising;
+	size_t             rising_count;
+	size_t             rising_capacity;
+	alert_threshold_t* falling;
+	size_t             falling_count;
+	size_t             falling_capacity;
+} alert_index_t;
+
+typedef struct alert_security {
+	char*              ticker;
+	alert_index_t**    indexes;      /* one per field, found by a scan */
+	volatile long      index_count;
+	size_t             index_capacity;
+	volatile long      lock;
+} alert_security_t;
+
+typedef struct alert_registration {
+	alert_security_t*  p_entry;
+	const char*        key;
+	double             threshold;
+	unsigned char      kind;
+	boolean            is_active;
+	unsigned int       generation;   /* bumped every time the slot is freed */
+	size_t             next_free;    /* next free slot + 1 while free, else 0 */
+} alert_registration_t;
+
+typedef struct alert_cell {
+	volatile long      sequence;
+	blp_alert_t        alert;
+} alert_cell_t;
+
+struct alert_engine {
+	tree_map_t            securities;   /* ticker -> alert_security_t */
+	alert_registration_t* registrations; /* by slot, see ALERT_ID */
+	size_t                registration_count;
+	size_t                registration_capacity;
+	size_t                free_registration; /* first free slot + 1, or 0 */
+	alert_cell_t*         cells;
+	unsigned long         mask;
+	volatile long         enqueue_position;
+	volatile long         dequeue_position;
+	volatile long         dropped;
+
+	#if defined(WIN32) || defined(WIN64)
+    CRITICAL_SECTION crit_section;
+	#endif
+};
+
+/*
+ * A snapshot is an immutable copy of a security's fields that is read
+ * without taking the security lock. String values that did not change
+ * since the previous snapshot are shared with it through a reference
+ * count instead of being copied again.
+ */
+typedef struct snapshot_string {
+	volatile long references;
+	char          text[ 1 ];
+} snapshot_string_t;
+
+typedef struct snapshot_field {
+	const char*        key;          /* canonical field key */
+	blp_version_t      version;
+	variant_t          value;
+	unsigned char      type;
+	unsigned char      scale;
+	unsigned char      is_inline;    /* value.string points at inline_value */
+	long long          fixed;
+	blp_value_code_t   code;
+	snapshot_string_t* p_string;     /* NULL unless value.string is a heap copy */
+	char               inline_value[ FIELD_INLINE_CAPACITY ];
+} snapshot_field_t;
+
+struct security_snapshot {
+	volatile long     references;
+	blp_version_t     version;
+	char*             ticker;
+	size_t            count;
+	snapshot_field_t  fields[ 1 ];   /* sorted by key */
 };
 
+/*
+ * The dictionary is expanded from bbfields.h three times, into a table of
+ * descriptors and two string pools. Every string is a char array member of
+ * a pool struct, named after its line in bbfields.h, so the descriptors
+ * hold offsetof() constants instead of pointers and need no relocations
+ * at load time. Descriptions are kept apart from the lookup data since
+ * only blp_field_description() reads them.
+ */
+#define BLP_FIELD_PASTE( prefix, line )   prefix##line
+#define BLP_FIELD_MEMBER( prefix, line )  BLP_FIELD_PASTE( prefix, line )
+
+typedef struct blp_field_mnemonics {
+	#define BLP_FIELD( mnemonic, type, description, scale )  char BLP_FIELD_MEMBER( field_, __LINE__ )[ sizeof(mnemonic) ];
+	#include "bbfields.h"
+	#undef BLP_FIELD
+} blp_field_mnemonics_t;
+
+typedef struct blp_field_descriptions {
+	#define BLP_FIELD( mnemonic, type, description, scale )  char BLP_FIELD_MEMBER( field_, __LINE__ )[ sizeof(description) ];
+	#include "bbfields.h"
+	#undef BLP_FIELD
+} blp_field_descriptions_t;
+
 typedef struct blp_field_descriptor {
-	const char *mnemonic;
+	unsigned int  mnemonic;  /* offset into FIELD_MNEMONICS */
 	unsigned char type;
-	const char *description;
+	unsigned char scale;     /* decimal places when stored as fixed-point */
 } blp_field_descriptor_t;
 
 static const blp_field_descriptor_t FIELDS[] = {
+	#define BLP_FIELD( mnemonic, type, description, scale )  { (unsigned int) offsetof( blp_field_mnemonics_t, BLP_FIELD_MEMBER( field_, __LINE__ ) ), type, scale },
 	#include "bbfields.h"
+	#undef BLP_FIELD
+};
+
+static const blp_field_mnemonics_t FIELD_MNEMONICS = {
+	#define BLP_FIELD( mnemonic, type, description, scale )  mnemonic,
+	#include "bbfields.h"
+	#undef BLP_FIELD
+};
+
+static const unsigned int FIELD_DESCRIPTION_OFFSETS[] = {
+	#define BLP_FIELD( mnemonic, type, description, scale )  (unsigned int) offsetof( blp_field_descriptions_t, BLP_FIELD_MEMBER( field_, __LINE__ ) ),
+	#include "bbfields.h"
+	#undef BLP_FIELD
+};
+
+static const blp_field_descriptions_t FIELD_DESCRIPTIONS = {
+	#define BLP_FIELD( mnemonic, type, description, scale )  description,
+	#include "bbfields.h"
+	#undef BLP_FIELD
 };
 
 #define BLP_FIELD_COUNT       (sizeof(FIELDS) / sizeof(blp_field_descriptor_t))
+#define FIELD_MNEMONIC( id )     ((const char *) &FIELD_MNEMONICS + FIELDS[ (id) ].mnemonic)
+#define FIELD_DESCRIPTION( id )  ((const char *) &FIELD_DESCRIPTIONS + FIELD_DESCRIPTION_OFFSETS[ (id) ])
+
+/*
+ * Types learned from the wire, indexed by field id; 0 means nothing has
+ * been learned and FIELDS[].type applies. Entries only ever go from 0 to
+ * a type, one byte at a time, so dispatcher threads can fill it in
+ * without taking a lock.
+ */
+static volatile unsigned char LEARNED_TYPES[ BLP_FIELD_COUNT ];
+static volatile unsigned char INTERNED_FIELDS[ BLP_FIELD_COUNT ]; /* values shared through the value pool */
+static volatile boolean       learn_field_types = FALSE;
+
+/*
+ * Binary dictionary file written by blp_field_dictionary_download(). It
+ * holds no pointers, so it is used straight from the mapping:
+ *
+ *   header | entries[count], sorted by mnemonic | strings[strings_size]
+ */
+#define FIELD_DICTIONARY_MAGIC    "BLPD"
+#define FIELD_DICTIONARY_VERSION  (1)
+
+typedef struct field_dictionary_header {
+	char         magic[ 4 ];
+	unsigned int version;
+	unsigned int count;
+	unsigned int strings_size;
+} field_dictionary_header_t;
+
+typedef struct field_dictionary_entry {
+	unsigned int  mnemonic;     /* offsets into the string table */
+	unsigned int  description;
+	unsigned char type;
+	unsigned char reserved[ 3 ];
+} field_dictionary_entry_t;
+
+/*
+ * A loaded dictionary. Lookups read the current one without locking, so
+ * a replaced dictionary is only retired, and it stays mapped until
+ * blp_field_dictionary_unload().
+ */
+typedef struct field_dictionary {
+	struct field_dictionary*        retired;
+	const field_dictionary_entry_t* entries;
+	const char*                     strings;
+	unsigned int                    count;
+	unsigned char                   types[ BLP_FIELD_COUNT ]; /* by compiled-in field id, 0 if absent */
+	const void*                     view;
+	size_t                          size;
+	#if defined(WIN32) || defined(WIN64)
+	HANDLE                          file;
+	HANDLE                          mapping;
+	#endif
+} field_dictionary_t;
+
+static field_dictionary_t* volatile runtime_dictionary = NULL;
+
+/*
+ * Trigram index over the compiled-in descriptions, built on first use.
+ * Trigrams are hashed into buckets holding the ids of every description
+ * that contains one; collisions only cost a few extra candidates since
+ * each one is checked against the full search text anyway.
+ */
+#define FIELD_TRIGRAM_BUCKETS  (1 << 16)
+
+typedef struct field_trigram_index {
+	unsigned int  offsets[ FIELD_TRIGRAM_BUCKETS + 1 ]; /* bucket i is ids[offsets[i]..offsets[i+1]) */
+	unsigned int* ids;
+} field_trigram_index_t;
+
+static field_trigram_index_t* volatile description_index = NULL;
+
+/*
+ * Field names are canonicalized once, when they enter the library, into
+ * a pointer that is unique per name: the dictionary mnemonic, or for
+ * names the dictionary lacks an upper-cased copy interned here. Security
+ * field maps then hash and compare those pointers, never the text.
+ */
+#define FIELD_KEY_MAX   256
+
+typedef struct field_registry {
+	hash_map_t    names;         /* canonical name -> itself */
+	boolean       is_initialized;
+	volatile long lock;
+} field_registry_t;
+
+static field_registry_t field_registry = { { 0 }, FALSE, 0 };
+
+/*
+ * Every allocation libblp makes goes through these. libcollections and
+ * BLPAPI keep their own allocators.
+ */
+typedef struct blp_allocator {
+	blp_malloc_function  malloc_fn;
+	blp_realloc_function realloc_fn;
+	blp_free_function    free_fn;
+	void*                context;
+} blp_allocator_t;
+
+static void* default_malloc  ( size_t size, void *context );
+static void* default_realloc ( void *ptr, size_t size, void *context );
+static void  default_free    ( void *ptr, void *context );
+
+static blp_allocator_t allocator = { default_malloc, default_realloc, default_free, NULL };
+
+/*
+ * Values of enumerated fields (status, sector, currency, ...) are kept
+ * once for the whole process and referred to by 32-bit codes. Pool
+ * strings are never freed, so field values can point straight at them.
+ */
+typedef struct value_pool {
+	hash_map_t    codes;          /* string -> code */
+	const char**  strings;        /* code -> string; code 0 is unused */
+	size_t        count;
+	size_t        capacity;
+	arena_t       storage;
+	boolean       is_initialized;
+	volatile long lock;
+} value_pool_t;
+
+static value_pool_t value_pool = { { 0 }, NULL, 0, 0, { NULL, 0, 0 }, FALSE, 0 };
+
+/*
+ * Derived fields are arithmetic over other fields, compiled to a short
+ * postfix program when they are registered. The registered set is
+ * immutable and replaced as a whole, so the update path reads it without
+ * a lock; replaced sets are kept until blp_derived_field_clear().
+ */
+#define DERIVED_MAX_INPUTS   8
+#define DERIVED_MAX_STEPS    32
+#define DERIVED_MAX_DEPTH    16
+#define DERIVED_MARKS_LOCAL  256  /* derived fields marked on the stack before falling back to the heap */
+#define DERIVED_NONE         ((size_t) -1)
+
+typedef enum derived_op {
+	DERIVED_INPUT = 0,
+	DERIVED_CONSTANT,
+	DERIVED_ADD,
+	DERIVED_SUBTRACT,
+	DERIVED_MULTIPLY,
+	DERIVED_DIVIDE,
+	DERIVED_NEGATE
+} derived_op_t;
+
+typedef struct derived_step {
+	unsigned char op;
+	unsigned char input;         /* index into inputs, for DERIVED_INPUT */
+	double        constant;
+} derived_step_t;
+
+typedef struct derived_field {
+	const char*    key;          /* canonical key of the derived field */
+	const char*    inputs[ DERIVED_MAX_INPUTS ];
+	size_t         input_count;
+	derived_step_t steps[ DERIVED_MAX_STEPS ];
+	size_t         step_count;
+	size_t         depth;        /* current stack depth, while parsing */
+} derived_field_t;
+
+/*
+ * Every key read by a derived field maps to the derived fields that
+ * depend on it, directly or through other derived fields, as indexes into
+ * the set in dependency order. An update only visits those.
+ */
+typedef struct derived_input {
+	const char*         key;           /* NULL for an empty slot */
+	size_t              first;         /* into the set's dependents */
+	size_t              count;
+} derived_input_t;
+
+typedef struct derived_set {
+	struct derived_set* retired;
+	derived_input_t*    inputs;        /* open addressing on the key pointer */
+	size_t              input_mask;
+	size_t*             dependents;
+	size_t              count;
+	derived_field_t     fields[ 1 ];   /* inputs come before the fields using them */
+} derived_set_t;
+
+/* The derived fields due for recomputation after one update. */
+typedef struct derived_pending {
+	const derived_set_t* p_set;
+	unsigned char*       marks;        /* one per field of the set, NULL to visit all */
+	size_t               first;
+	size_t               last;         /* the marked range, empty when first > last */
+	unsigned char        local[ DERIVED_MARKS_LOCAL ];
+} derived_pending_t;
+
+static derived_set_t* volatile derived_fields = NULL;
+static volatile long           derived_lock   = 0;
+
+/* Field metadata collected from //blp/apiflds before it is written out. */
+typedef struct field_info {
+	char*         mnemonic;
+	char*         description;
+	unsigned char type;
+} field_info_t;
+
+typedef struct field_info_list {
+	field_info_t* fields;
+	size_t        count;
+	size_t        capacity;
+} field_info_list_t;
+
+/* Defined with the subscription object; the event handlers below take one. */
+typedef struct subscription_shard subscription_shard_t;
 
 static const char* blp_field_mneumonic_by_index   ( size_t index );
 static const char* blp_field_description_by_index ( size_t index );
 static const char* blp_service_name           ( service_type_t type );
-static boolean     security_set_field_from_bb ( security_t *p_security, const char *field, const char *value );
-static boolean     field_initialize           ( const char *field, const char *value, field_t *p_field );
-static boolean     string_conversion          ( const char *string, variant_t* p_variant );
+static unsigned char blp_field_type_by_id     ( blp_field_id_t id );
+static unsigned char blp_field_learn_type     ( blp_field_id_t id, const blpapi_Element_t *p_element );
+static const field_dictionary_entry_t* field_dictionary_find( const field_dictionary_t *p_dictionary, const char *field );
+static void        field_dictionary_unmap     ( field_dictionary_t *p_dictionary );
+static size_t      field_trigram_bucket       ( const char *text );
+static boolean     field_canonical_name       ( const char *field, char *canonical );
+static blp_field_id_t field_id_by_canonical_name( const char *canonical );
+static const char* field_key_find             ( const char *field );
+static const char* field_key_intern           ( const char *field );
+static size_t      field_key_hash             ( const void *key );
+static int         field_key_compare          ( const void *p_left, const void *p_right );
+static boolean     field_registry_destroy     ( void *key, void *value );
+static const field_trigram_index_t* field_trigram_index( void );
+static boolean     field_text_contains        ( const char *text, const char *lowercase_search, size_t length );
+static field_t*    security_field_for_update  ( security_t *p_security, const char *field );
+static field_t*    security_field_alloc       ( security_t *p_security );
+static void        security_field_changed     ( security_t *p_security, const char *field, field_t *p_field );
+static void        security_field_free        ( security_t *p_security, field_t *p_field );
+static security_snapshot_t* security_snapshot_build( security_t *p_security );
+static void        security_update_derived    ( security_t *p_security, derived_pending_t *p_pending, blp_version_t since );
+static void        security_publish_field     ( security_t *p_security, const char *key, field_t *p_field );
+static alert_security_t* alert_engine_entry   ( alert_engine_t *p_engine, const char *ticker );
+static boolean     alert_engine_entries_destroy( void *p_key, void *p_value );
+static alert_index_t* alert_security_index   ( alert_security_t *p_entry, const char *key );
+static void        alert_security_update      ( alert_engine_t *p_engine, alert_security_t *p_entry, alert_index_t *p_index, double value );
+static boolean     alert_thresholds_insert    ( alert_threshold_t **p_thresholds, size_t *p_count, size_t *p_capacity, const alert_threshold_t *p_threshold );
+static void        alert_thresholds_remove    ( alert_threshold_t *thresholds, size_t *p_count, blp_alert_id_t id, double threshold );
+static size_t      alert_thresholds_lower_bound( const alert_threshold_t *thresholds, size_t count, double value, boolean is_inclusive );
+static void        alert_engine_push          ( alert_engine_t *p_engine, const alert_security_t *p_entry, const alert_index_t *p_index, const alert_threshold_t *p_threshold, unsigned char direction, double value );
+static boolean     field_as_decimal           ( field_t *p_field, double *p_value );
+static boolean     derived_parse              ( const char *expression, derived_field_t *p_derived );
+static boolean     derived_parse_sum          ( const char **p_text, derived_field_t *p_derived );
+static boolean     derived_parse_product      ( const char **p_text, derived_field_t *p_derived );
+static boolean     derived_parse_unary        ( const char **p_text, derived_field_t *p_derived );
+static boolean     derived_emit               ( derived_field_t *p_derived, unsigned char op, unsigned char input, double constant );
+static boolean     derived_evaluate           ( const derived_field_t *p_derived, const double *inputs, double *p_result );
+static boolean     derived_set_replace        ( const char *key, const derived_field_t *p_derived );
+static boolean     derived_set_index          ( derived_set_t *p_set );
+static void        derived_set_free           ( derived_set_t *p_set );
+static void        derived_pending_begin      ( derived_pending_t *p_pending );
+static void        derived_pending_add        ( derived_pending_t *p_pending, const char *key );
+static size_t      universe_table_add_row     ( universe_table_t *p_universe, const char *ticker );
+static const column_kernels_t* column_kernels ( void );
+static size_t      column_sum_scalar          ( const double *values, const unsigned char *validity, size_t count, double *p_sum );
+static double      column_squares_scalar      ( const double *values, const unsigned char *validity, size_t count, double mean );
+static size_t      column_min_max_scalar      ( const double *values, const unsigned char *validity, size_t count, double *p_min, double *p_max );
+#if defined(BLP_COLUMN_AVX2)
+static boolean     column_cpu_has_avx2        ( void );
+static size_t      column_sum_avx2            ( const double *values, const unsigned char *validity, size_t count, double *p_sum );
+static double      column_squares_avx2        ( const double *values, const unsigned char *validity, size_t count, double mean );
+static size_t      column_min_max_avx2        ( const double *values, const unsigned char *validity, size_t count, double *p_min, double *p_max );
+#endif
+static void        universe_table_remove_row  ( universe_table_t *p_universe, size_t row );
+static void        universe_table_store       ( universe_table_t *p_universe, size_t row, const char *key, field_t *p_field );
+static const snapshot_field_t* security_snapshot_field( const security_snapshot_t *p_snapshot, const char *field );
+static int         snapshot_field_compare     ( const void *p_left, const void *p_right );
+static char*       security_string_copy       ( security_t *p_security, const char *value );
+static blp_field_id_t field_id_by_key         ( const char *key );
+static const char* value_intern               ( const char *value, blp_value_code_t *p_code );
+static boolean     interned_conversion        ( const char *string, field_t *p_field );
+static void        security_arena_compact     ( security_t *p_security );
+static void        arena_initialize           ( arena_t *p_arena, size_t block_size );
+static void*       arena_alloc                ( arena_t *p_arena, size_t size );
+static void        arena_destroy              ( arena_t *p_arena );
+static unsigned char security_storage_type    ( const security_t *p_security, const char *field, unsigned char type, unsigned char scale );
+static boolean     security_set_field_from_bb ( security_t *p_security, const char *field, unsigned char type, unsigned char scale, const char *value );
+static field_t*    security_store_from_bb     ( security_t *p_security, const char *field, unsigned char type, unsigned char scale, const char *value );
+static field_t*    security_store_update      ( security_t *p_security, const char *field, field_t *p_update );
+static boolean     security_stage_field       ( const security_t *p_security, staged_field_t *p_staged, const char *field, unsigned char type, unsigned char scale, const blpapi_Element_t *p_element );
+static void        security_apply_staged      ( security_t *p_security, staged_field_t *staged, size_t count );
+static boolean     security_set_field_from_element( security_t *p_security, const char *field, unsigned char type, unsigned char scale, const blpapi_Element_t *p_element );
+static boolean     field_initialize           ( unsigned char type, unsigned char scale, const char *value, field_t *p_field );
+static boolean     field_initialize_from_element( unsigned char type, unsigned char scale, const blpapi_Element_t *p_element, field_t *p_field, const char **p_string );
+static void        field_clear_value          ( field_t *p_field );
+static void        field_assign               ( field_t *p_field, const field_t *p_update );
+static boolean     field_raw_is_valid         ( unsigned char type, unsigned char scale, const char *value );
+static boolean     field_store_raw            ( field_t *p_field, unsigned char type, unsigned char scale, const char *value );
+static void        field_resolve              ( field_t *p_field );
+static double      datetime_seconds           ( const blpapi_Datetime_t *p_datetime );
+static boolean     string_conversion          ( const char *string, field_t *p_field );
+static boolean     field_set_inline_string    ( field_t *p_field, const char *string, size_t length );
 static boolean     decimal_conversion         ( const char *string, variant_t* p_variant );
 static boolean     integer_conversion         ( const char *string, variant_t* p_variant );
 static boolean     unsigned_integer_conversion( const char *string, variant_t* p_variant );
-static int         field_descriptor_compare   ( const void *p_left, const void *p_right );
+static boolean     parse_decimal              ( const char *string, double *p_value );
+static boolean     parse_integer              ( const char *string, long *p_value );
+static boolean     parse_unsigned_integer     ( const char *string, unsigned long *p_value );
+static boolean     parse_fixed                ( const char *string, unsigned char scale, long long *p_value );
+static boolean     fixed_conversion           ( const char *string, unsigned char scale, field_t *p_field );
+static long long   fixed_from_decimal         ( double value, unsigned char scale );
+static double      fixed_to_decimal           ( long long value, unsigned char scale );
+static int         field_descriptor_compare   ( const void *p_key, const void *p_descriptor );
 security_t*        subscription_create_security_if_none( subscription_t *p_subscription, const char *ticker );
 static size_t      get_time_stamp             (char *buffer, size_t bufSize);
 
@@ -123,26 +740,40 @@ enum ErrorNum {
 	FailedToOpenService,
 	FailedToCreateSessionOptions,
 	OutOfMemory,
+	FailedToCreateDispatcher,
+	InvalidSessionOption,
 	ERROR_NUM_COUNT
 };
 
 static const char *ERRORS[] = {
 	"None",
 	"Failed to start session.",
-	"Failed to start session.",
+	"Failed to open service.",
+	"Failed to create session options.",
 	"Out of memory.",
+	"Failed to create event dispatcher.",
+	"Invalid session option.",
 	NULL
 };
 
+static void*   blp_malloc                           ( size_t size );
+static void*   blp_realloc                          ( void *ptr, size_t size );
+static void    blp_free                             ( void *ptr );
+static char*   blp_strdup                           ( const char *string );
 static int     debug_writer                         ( const char* data, int length, void *stream );
 static boolean security_fields_destroy              ( void *key, void *value );
+static boolean security_arena_fields_destroy        ( void *key, void *value );
 static boolean security_overrides_destroy           ( void *key, void *value );
 static boolean subscription_securities_destroy      ( void *key, void *value );
 static void    handle_reference_data_event          ( blp_t *p_blp, const blpapi_Event_t *event, security_t *p_security );
 static void    handle_reference_data_other_event    ( blp_t *p_blp, const blpapi_Event_t *event );
+static void    handle_field_list_event              ( blp_t *p_blp, const blpapi_Event_t *event, field_info_list_t *p_list );
+static boolean field_info_list_add                  ( field_info_list_t *p_list, const char *mnemonic, const char *datatype, const char *description );
+static int     field_info_compare                   ( const void *p_left, const void *p_right );
+static boolean field_dictionary_write               ( const char *filename, field_info_list_t *p_list );
 static void    market_data_event_handler            ( blpapi_Event_t *p_event, blpapi_Session_t *session, void *user_data );
-static void    handle_market_data_event             ( blpapi_Event_t *p_event, blpapi_Session_t *session, subscription_t *p_subscription );
-static void    handle_market_data_other_event       ( blpapi_Event_t *p_event, blpapi_Session_t *session, subscription_t *p_subscription );
+static void    handle_market_data_event             ( blpapi_Event_t *p_event, blpapi_Session_t *session, subscription_shard_t *p_shard );
+static void    handle_market_data_other_event       ( blpapi_Event_t *p_event, blpapi_Session_t *session, subscription_shard_t *p_shard );
 
 blp_t *blp_create( const char *host, short port )
 {
@@ -180,13 +811,15 @@ blp_t *blp_create( const char *host, short port )
 		return NULL;
 	}
 
-	p_blp = (blp_t *) malloc( sizeof(blp_t) );
+	p_blp = (blp_t *) blp_malloc( sizeof(blp_t) );
 
 	if( p_blp )
 	{
-		p_blp->error_num       = 0;
-		p_blp->debug           = FALSE;
-		p_blp->session_options = p_session_options;
+		p_blp->error_num           = 0;
+		p_blp->debug               = FALSE;
+		p_blp->session_options     = p_session_options;
+		p_blp->dispatcher_threads  = 0;
+		p_blp->dispatcher_affinity = 0;
 	}
 	else
 	{
@@ -200,7 +833,76 @@ blp_t *blp_create( const char *host, short port )
 void blp_destroy( blp_t *p_blp )
 {
 	blpapi_SessionOptions_destroy( p_blp->session_options );
-	free( p_blp );
+	blp_free( p_blp );
+}
+
+/*
+ * Installs the allocator used for everything libblp allocates. Call it
+ * before creating anything: memory is handed back to whichever allocator
+ * is installed when it is freed. NULL functions restore the C runtime's.
+ */
+void blp_set_allocator( blp_malloc_function malloc_fn, blp_realloc_function realloc_fn, blp_free_function free_fn, void *context )
+{
+	if( malloc_fn && realloc_fn && free_fn )
+	{
+		allocator.malloc_fn  = malloc_fn;
+		allocator.realloc_fn = realloc_fn;
+		allocator.free_fn    = free_fn;
+		allocator.context    = context;
+	}
+	else
+	{
+		allocator.malloc_fn  = default_malloc;
+		allocator.realloc_fn = default_realloc;
+		allocator.free_fn    = default_free;
+		allocator.context    = NULL;
+	}
+}
+
+void* default_malloc( size_t size, void *context )
+{
+	return malloc( size );
+}
+
+void* default_realloc( void *ptr, size_t size, void *context )
+{
+	return realloc( ptr, size );
+}
+
+void default_free( void *ptr, void *context )
+{
+	free( ptr );
+}
+
+void* blp_malloc( size_t size )
+{
+	return allocator.malloc_fn( size, allocator.context );
+}
+
+void* blp_realloc( void *ptr, size_t size )
+{
+	return allocator.realloc_fn( ptr, size, allocator.context );
+}
+
+void blp_free( void *ptr )
+{
+	if( ptr )
+	{
+		allocator.free_fn( ptr, allocator.context );
+	}
+}
+
+char* blp_strdup( const char *string )
+{
+	size_t size = strlen( string ) + 1;
+	char *copy  = (char *) blp_malloc( size );
+
+	if( copy )
+	{
+		memcpy( copy, string, size );
+	}
+
+	return copy;
 }
 
 unsigned short blp_error_code( const blp_t *p_blp )
@@ -223,965 +925,6472 @@ const char* blp_error( const blp_t *p_blp )
 	return ERRORS[ NoError ];
 }
 
-const char *blp_service_name( service_type_t type )
-{
-	return type < SERVICE_TYPE_COUNT ? SERVICES[ type ] : NULL;
-}
-
-unsigned short blp_field_count( void )
+boolean blp_set_dispatcher_threads( blp_t *p_blp, size_t number_of_threads )
 {
-	return BLP_FIELD_COUNT;
+	assert( p_blp );
+	p_blp->dispatcher_threads = number_of_threads;
+	return TRUE;
 }
 
-unsigned short blp_field_type( const char *field )
+boolean blp_set_max_event_queue_size( blp_t *p_blp, size_t size )
 {
-	blp_field_descriptor_t *p_field_descriptor;
+	assert( p_blp );
 
-	blp_field_descriptor_t key;
+	if( 0 != blpapi_SessionOptions_setMaxEventQueueSize( p_blp->session_options, size ) )
+	{
+		p_blp->error_num = InvalidSessionOption;
+		return FALSE;
+	}
 
-	key.mnemonic    = field;
-	//key.type        = 0;
-	//key.description = NULL;
+	return TRUE;
+}
 
-	p_field_descriptor = (blp_field_descriptor_t *) bsearch( &key, FIELDS, BLP_FIELD_COUNT, sizeof(blp_field_descriptor_t), field_descriptor_compare );	
+boolean blp_set_slow_consumer_warning( blp_t *p_blp, float hi_water_mark, float lo_water_mark )
+{
+	assert( p_blp );
 
-	if( p_field_descriptor )
+	/* The marks are fractions of the maximum event queue size and the low
+	 * mark must stay below the high mark, so set the high mark first.
+	 */
+	if( 0 != blpapi_SessionOptions_setSlowConsumerWarningHiWaterMark( p_blp->session_options, hi_water_mark ) ||
+	    0 != blpapi_SessionOptions_setSlowConsumerWarningLoWaterMark( p_blp->session_options, lo_water_mark ) )
 	{
-		return p_field_descriptor->type;
+		p_blp->error_num = InvalidSessionOption;
+		return FALSE;
 	}
 
-	return BLP_FIELD_TYPE_NONE;
+	return TRUE;
 }
 
-const char* blp_field_description( const char *field )
+void blp_set_dispatcher_affinity( blp_t *p_blp, unsigned long long cpu_mask )
 {
-	blp_field_descriptor_t *p_field_descriptor;
-
-	blp_field_descriptor_t key;
+	assert( p_blp );
+	p_blp->dispatcher_affinity = cpu_mask;
+}
 
-	key.mnemonic    = field;
-	key.type        = 0;
-	key.description = NULL;
+/*
+ * BLPAPI creates the dispatcher threads itself, so they are pinned from
+ * inside the first time each one delivers an event.
+ */
+static THREAD_LOCAL unsigned long long dispatcher_thread_affinity = 0;
 
-	p_field_descriptor = (blp_field_descriptor_t *) bsearch( &key, FIELDS, BLP_FIELD_COUNT, sizeof(blp_field_descriptor_t), field_descriptor_compare );	
+static void dispatcher_thread_pin( unsigned long long cpu_mask )
+{
+	if( cpu_mask == 0 || cpu_mask == dispatcher_thread_affinity )
+	{
+		return;
+	}
 
-	if( p_field_descriptor )
+	#if defined(WIN32) || defined(WIN64)
+	SetThreadAffinityMask( GetCurrentThread( ), (DWORD_PTR) cpu_mask );
+	#else
 	{
-		return p_field_descriptor->description;
+		cpu_set_t cpus;
+		int cpu;
+
+		CPU_ZERO( &cpus );
+		for( cpu = 0; cpu < 64; cpu++ )
+		{
+			if( cpu_mask & (1ULL << cpu) )
+			{
+				CPU_SET( cpu, &cpus );
+			}
+		}
+
+		pthread_setaffinity_np( pthread_self( ), sizeof(cpus), &cpus );
 	}
+	#endif
 
-	return NULL;
+	dispatcher_thread_affinity = cpu_mask;
 }
 
-const char* blp_field_mneumonic_by_index( size_t index )
+const char *blp_service_name( service_type_t type )
 {
-	return index < BLP_FIELD_COUNT ? FIELDS[ index ].mnemonic : NULL;
+	return type < SERVICE_TYPE_COUNT ? SERVICES[ type ] : NULL;
 }
 
-const char* blp_field_description_by_index( size_t index )
+unsigned short blp_field_count( void )
 {
-	return index < BLP_FIELD_COUNT ? FIELDS[ index ].description : NULL;
+	return BLP_FIELD_COUNT;
 }
 
-
-int debug_writer( const char* data, int length, void *stream )
+blp_field_id_t blp_field_id( const char *field )
 {
-	assert(data);
-	assert(stream);
-	return (int) fwrite(data, length, 1, (FILE *)stream);
-}
+	char canonical[ FIELD_KEY_MAX ];
 
+	if( !field_canonical_name( field, canonical ) )
+	{
+		return BLP_FIELD_ID_NONE;
+	}
 
-static field_t*         security_field           ( const security_t *p_security, const char *field );
-static const variant_t* security_field_value     ( const security_t *p_security, const char *field );
+	return field_id_by_canonical_name( canonical );
+}
 
-security_t* security_create( void )
+unsigned short blp_field_type( const char *field )
 {
-	security_t *p_security = (security_t *) malloc( sizeof(security_t) );
-	
-	#if defined(WIN32) || defined(WIN64)
-	InitializeCriticalSection( &p_security->crit_section );
-	#endif
-
-	ACQUIRE_LOCK( p_security );
+	char canonical[ FIELD_KEY_MAX ];
+	blp_field_id_t id;
 
-	if( p_security )
+	if( !field_canonical_name( field, canonical ) )
 	{
-		memset( &p_security->iterator, 0, sizeof(p_security->iterator) );
+		return BLP_FIELD_TYPE_NONE;
+	}
+
+	id = field_id_by_canonical_name( canonical );
 
-		p_security->ticker = NULL;
+	if( id != BLP_FIELD_ID_NONE )
+	{
+		return blp_field_type_by_id( id );
+	}
+	else
+	{
+		const field_dictionary_entry_t *p_entry = field_dictionary_find( runtime_dictionary, canonical );
 
-		if( !hash_map_create( &p_security->fields, FIELDS_TABLE_LARGE, string_hash, security_fields_destroy, (hash_map_compare_function) strcasecmp ) )
+		if( p_entry )
 		{
-			goto fields_failed;
+			return p_entry->type;
 		}
-
-		tree_map_create( &p_security->overrides, security_overrides_destroy, (tree_map_compare_function) strcasecmp );
 	}
 
-	
-	RELEASE_LOCK( p_security );
-	return p_security;
-
-fields_failed:
-	free( p_security );
-	RELEASE_LOCK( p_security );
-	return NULL;
+	return BLP_FIELD_TYPE_NONE;
 }
 
-void security_destroy( security_t *p_security )
+const char* blp_field_description( const char *field )
 {
-	ACQUIRE_LOCK( p_security );
-
-	assert( p_security );
+	char canonical[ FIELD_KEY_MAX ];
+	blp_field_id_t id;
 
-	if( p_security->ticker )
+	if( !field_canonical_name( field, canonical ) )
 	{
-		free( p_security->ticker );
+		return NULL;
 	}
 
-	hash_map_destroy( &p_security->fields );
-	tree_map_destroy( &p_security->overrides );
+	id = field_id_by_canonical_name( canonical );
 
-	RELEASE_LOCK( p_security );
-	#if defined(WIN32) || defined(WIN64)
-	DeleteCriticalSection( &p_security->crit_section );
-	#endif
+	if( id != BLP_FIELD_ID_NONE )
+	{
+		return FIELD_DESCRIPTION( id );
+	}
+	else
+	{
+		const field_dictionary_t *p_dictionary  = runtime_dictionary;
+		const field_dictionary_entry_t *p_entry = field_dictionary_find( p_dictionary, canonical );
 
-	#if defined(_DEBUG)
-	memset( p_security, 0, sizeof(security_t) );
-	#endif
+		if( p_entry )
+		{
+			return p_dictionary->strings + p_entry->description;
+		}
+	}
 
-	free( p_security );
+	return NULL;
 }
 
-boolean security_fields_destroy( void *key, void *value )
+const char* blp_field_mneumonic_by_index( size_t index )
 {
-	field_t *p_field = (field_t *) value;
-
-	assert( key );
-	assert( p_field );
-
-	free( key );
-	if( variant_is_string( &p_field->value ) )
-	{
-		free( variant_string(&p_field->value) );
-	}
-	free( p_field );
-	return TRUE;
+	return index < BLP_FIELD_COUNT ? FIELD_MNEMONIC( index ) : NULL;
 }
 
-boolean security_overrides_destroy( void *key, void *value )
+const char* blp_field_description_by_index( size_t index )
 {
-	assert( key );
-	assert( value );
-	free( key );
-	free( value );
-	return TRUE;
-}
-
-const char* security_ticker( const security_t *p_security )
-{
-	assert( p_security );
-	return p_security->ticker;
+	return index < BLP_FIELD_COUNT ? FIELD_DESCRIPTION( index ) : NULL;
 }
 
-boolean security_set_ticker( security_t *p_security, const char *ticker )
+/*
+ * The canonical spelling of a field name is upper case, which is how the
+ * dictionary and BLPAPI spell mnemonics. Names that do not fit in
+ * FIELD_KEY_MAX are rejected.
+ */
+boolean field_canonical_name( const char *field, char *canonical )
 {
-	assert( p_security );
-	ACQUIRE_LOCK( p_security );
-	p_security->ticker = _strdup( ticker );
-	RELEASE_LOCK( p_security );
+	size_t i;
 
-	return p_security->ticker != NULL;
-}
+	if( !field )
+	{
+		return FALSE;
+	}
 
-boolean security_has_field( const security_t *p_security, const char *field )
-{
-	const field_t *value;
-	boolean result = FALSE;
+	for( i = 0; field[ i ]; i++ )
+	{
+		if( i == FIELD_KEY_MAX - 1 )
+		{
+			return FALSE;
+		}
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	result = hash_map_find( &p_security->fields, field, (void **) &value );
-	RELEASE_LOCK( p_security );
+		canonical[ i ] = (char) toupper( (unsigned char) field[ i ] );
+	}
 
-	return result;
+	canonical[ i ] = '\0';
+	return TRUE;
 }
 
-size_t security_field_count( const security_t *p_security )
+blp_field_id_t field_id_by_canonical_name( const char *canonical )
 {
-	size_t count = 0;
+	blp_field_descriptor_t *p_field_descriptor;
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	count = hash_map_size( &p_security->fields );
-	RELEASE_LOCK( p_security );
+	p_field_descriptor = (blp_field_descriptor_t *) bsearch( canonical, FIELDS, BLP_FIELD_COUNT, sizeof(blp_field_descriptor_t), field_descriptor_compare );	
 
-	return count;
+	if( p_field_descriptor )
+	{
+		return (blp_field_id_t) (p_field_descriptor - FIELDS);
+	}
+
+	return BLP_FIELD_ID_NONE;
 }
 
-field_t *security_field( const security_t *p_security, const char *field )
+/*
+ * Returns the canonical key for field, or NULL if no security can have
+ * it because it was never interned. Keys that are already canonical
+ * dictionary mnemonics are returned as they are.
+ */
+const char* field_key_find( const char *field )
 {
-	field_t *value = NULL;
+	char canonical[ FIELD_KEY_MAX ];
+	const char *key = NULL;
+	blp_field_id_t id;
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	hash_map_find( &p_security->fields, field, (void **) &value );
-	RELEASE_LOCK( p_security );
+	if( field >= (const char *) &FIELD_MNEMONICS && field < (const char *) (&FIELD_MNEMONICS + 1) )
+	{
+		return field;
+	}
 
-	return value;	
-}
+	if( !field_canonical_name( field, canonical ) )
+	{
+		return NULL;
+	}
 
-const variant_t* security_field_value( const security_t *p_security, const char *field )
-{
-	const field_t *p_field = NULL;
+	id = field_id_by_canonical_name( canonical );
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
+	if( id != BLP_FIELD_ID_NONE )
+	{
+		return FIELD_MNEMONIC( id );
+	}
 
-	if( hash_map_find( &p_security->fields, field, (void **) &p_field ) )
+	SPIN_LOCK( &field_registry.lock );
+	if( field_registry.is_initialized && !hash_map_find( &field_registry.names, canonical, (void **) &key ) )
 	{
-		RELEASE_LOCK( p_security );
-		return &p_field->value;
+		key = NULL;
 	}
+	SPIN_UNLOCK( &field_registry.lock );
 
-	RELEASE_LOCK( p_security );
-	return NULL;	
+	return key;
 }
 
-unsigned short security_field_type( const security_t *p_security, const char *field )
+/*
+ * Like field_key_find() but interns names the dictionary does not know.
+ * Interned names live until blp_field_registry_clear().
+ */
+const char* field_key_intern( const char *field )
 {
-	const field_t *p_field = NULL;
+	char canonical[ FIELD_KEY_MAX ];
+	const char *key = field_key_find( field );
+	char *copy      = NULL;
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
+	if( key || !field_canonical_name( field, canonical ) )
+	{
+		return key;
+	}
 
-	p_field = security_field( p_security, field );
+	SPIN_LOCK( &field_registry.lock );
+	if( !field_registry.is_initialized )
+	{
+		field_registry.is_initialized = hash_map_create( &field_registry.names, FIELDS_TABLE_MEDIUM, string_hash, field_registry_destroy, (hash_map_compare_function) strcmp );
+	}
 
-	if( p_field )
+	if( field_registry.is_initialized && !hash_map_find( &field_registry.names, canonical, (void **) &key ) )
 	{
-		variant_type_t type = variant_type( &p_field->value );
-		RELEASE_LOCK( p_security );
-		return (unsigned short) type;
+		copy = blp_strdup( canonical );
+
+		if( copy && hash_map_insert( &field_registry.names, copy, copy ) )
+		{
+			key = copy;
+		}
+		else
+		{
+			blp_free( copy );
+			key = NULL;
+		}
 	}
+	SPIN_UNLOCK( &field_registry.lock );
 
-	RELEASE_LOCK( p_security );
-	return BLP_FIELD_TYPE_NONE;
+	return key;
 }
 
-const char* security_field_value_as_string( const security_t *p_security, const char *field )
+size_t field_key_hash( const void *key )
 {
-	const variant_t* p_variant = security_field_value( p_security, field );
-	const char* result = NULL;
-	
-	ACQUIRE_LOCK( p_security );
-	if( p_variant && p_variant->type == BLP_FIELD_TYPE_STRING )
-	{
-		result = p_variant->value.string;
-	}
-	RELEASE_LOCK( p_security );
-
-	return result;
+	/* keys are unique pointers; drop the alignment bits and mix */
+	size_t value = (size_t) key >> 3;
+	return value ^ (value >> 16) ^ (value * 2654435761u);
 }
 
-boolean security_set_field_value_as_string( security_t *p_security, const char *field, const char *value )
+int field_key_compare( const void *p_left, const void *p_right )
 {
-	field_t *p_field = NULL;
-	boolean result   = FALSE;
-	assert( p_security );
+	return p_left == p_right ? 0 : (p_left < p_right ? -1 : 1);
+}
 
-	p_field = security_field( p_security, field );
+boolean field_registry_destroy( void *key, void *value )
+{
+	blp_free( key );
+	return TRUE;
+}
 
-	ACQUIRE_LOCK( p_security );
-	if( p_field )
+/*
+ * Frees the interned names. Only safe once no security, subscription or
+ * decode table refers to them any more.
+ */
+void blp_field_registry_clear( void )
+{
+	SPIN_LOCK( &field_registry.lock );
+	if( field_registry.is_initialized )
 	{
-		assert( variant_is_type( &p_field->value, VARIANT_STRING ) );
+		hash_map_destroy( &field_registry.names );
+		field_registry.is_initialized = FALSE;
+	}
+	SPIN_UNLOCK( &field_registry.lock );
+}
 
-		if( variant_is_string( &p_field->value ) )
-		{
-			free( variant_string( &p_field->value ) );
-			variant_set_type( &p_field->value, VARIANT_NOT_INITIALIZED );
-		}
+/*
+ * Maps a canonical key back to its dictionary id. Mnemonics are laid out
+ * in dictionary order, so the offsets in FIELDS[] are sorted too.
+ */
+blp_field_id_t field_id_by_key( const char *key )
+{
+	size_t offset;
+	size_t low  = 0;
+	size_t high = BLP_FIELD_COUNT;
 
-		result = string_conversion( value, &p_field->value );
-	}
-	else
+	if( !(key >= (const char *) &FIELD_MNEMONICS && key < (const char *) (&FIELD_MNEMONICS + 1)) )
 	{
-		p_field = (field_t *) malloc( sizeof(field_t) );
-
-		assert( p_security );
-		assert( field );
-		assert( value );
+		return BLP_FIELD_ID_NONE;
+	}
 
-		if( p_field )
-		{
-			char *field_copy = strdup(field);
-		
-			memset( p_field, 0, sizeof(field_t) );
+	offset = (size_t) (key - (const char *) &FIELD_MNEMONICS);
 
-			if( !field_copy )
-			{
-				free( p_field );
-				result = FALSE;
-				goto done;
-			}
-		
-			if( !string_conversion( value, &p_field->value ) )
-			{
-				free( p_field );
-				free( field_copy );
-				result = FALSE;
-				goto done;
-			}
+	while( low < high )
+	{
+		size_t middle = low + (high - low) / 2;
 
-			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		if( FIELDS[ middle ].mnemonic == offset )
+		{
+			return (blp_field_id_t) middle;
+		}
+		else if( FIELDS[ middle ].mnemonic < offset )
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
 		}
 	}
 
-done:
-	RELEASE_LOCK( p_security );
-	return result;
+	return BLP_FIELD_ID_NONE;
 }
 
-double security_field_value_as_decimal( const security_t *p_security, const char *field )
+/*
+ * Marks a dictionary field as enumerated: its string values are stored
+ * once in the value pool and compared by code. Takes effect with the
+ * next update of each security.
+ */
+boolean blp_set_field_interned( const char *field, boolean is_interned )
 {
-	const variant_t* p_variant = security_field_value( p_security, field );
-	double result = 0.0;
-	
-	ACQUIRE_LOCK( p_security );
-	if( p_variant && p_variant->type == BLP_FIELD_TYPE_DECIMAL )
+	blp_field_id_t id = blp_field_id( field );
+
+	if( id == BLP_FIELD_ID_NONE )
 	{
-		result = p_variant->value.decimal;
+		return FALSE;
 	}
-	RELEASE_LOCK( p_security );
 
-	return result;
+	INTERNED_FIELDS[ id ] = is_interned ? 1 : 0;
+	return TRUE;
 }
 
-boolean security_set_field_value_as_decimal( security_t *p_security, const char *field, double value )
+const char* value_intern( const char *value, blp_value_code_t *p_code )
 {
-	field_t *p_field = NULL;
-	boolean result   = FALSE;
-	assert( p_security );
+	const char *result = NULL;
+	void *code         = NULL;
 
-	p_field = security_field( p_security, field );
+	SPIN_LOCK( &value_pool.lock );
+	if( !value_pool.is_initialized )
+	{
+		arena_initialize( &value_pool.storage, VALUE_POOL_BLOCK );
+		value_pool.is_initialized = hash_map_create( &value_pool.codes, FIELDS_TABLE_LARGE, string_hash, NULL, (hash_map_compare_function) strcmp );
+	}
 
-	ACQUIRE_LOCK( p_security );
-	if( p_field )
+	if( !value_pool.is_initialized )
 	{
-		assert( variant_is_type( &p_field->value, VARIANT_DECIMAL ) );
+		goto done;
+	}
+
+	if( hash_map_find( &value_pool.codes, value, &code ) )
+	{
+		*p_code = (blp_value_code_t) (size_t) code;
+		result  = value_pool.strings[ *p_code ];
+		goto done;
+	}
+
+	if( value_pool.count + 1 >= value_pool.capacity )
+	{
+		size_t capacity      = value_pool.capacity ? 2 * value_pool.capacity : 256;
+		const char **strings = (const char **) blp_realloc( (void *) value_pool.strings, capacity * sizeof(const char *) );
 
-		if( variant_is_string( &p_field->value ) )
+		if( !strings || capacity > (size_t) UINT_MAX )
 		{
-			free( variant_string( &p_field->value ) );
+			blp_free( (void *) strings );
+			goto done;
 		}
 
-		variant_set_type( &p_field->value, VARIANT_DECIMAL );
-		p_field->value.value.decimal = value;
-		result = TRUE;
+		value_pool.strings  = strings;
+		value_pool.capacity = capacity;
 	}
-	else
-	{
-		p_field = (field_t *) malloc( sizeof(field_t) );
 
-		assert( p_security );
-		assert( field );
+	{
+		size_t length = strlen( value ) + 1;
+		char *copy    = (char *) arena_alloc( &value_pool.storage, length );
 
-		if( p_field )
+		if( !copy )
 		{
-			char *field_copy = strdup(field);
-		
-			memset( p_field, 0, sizeof(field_t) );
-
-			if( !field_copy )
-			{
-				free( p_field );
-				result = FALSE;
-				goto done;
-			}
+			goto done;
+		}
 
-			variant_set_type( &p_field->value, VARIANT_DECIMAL );
-			p_field->value.value.decimal = value;
+		memcpy( copy, value, length );
 
-			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		if( !hash_map_insert( &value_pool.codes, copy, (void *) (value_pool.count + 1) ) )
+		{
+			goto done; /* the copy stays in the arena */
 		}
+
+		value_pool.count++;
+		value_pool.strings[ value_pool.count ] = copy;
+		*p_code = (blp_value_code_t) value_pool.count;
+		result  = copy;
 	}
 
 done:
-	RELEASE_LOCK( p_security );
+	SPIN_UNLOCK( &value_pool.lock );
 	return result;
 }
 
-long security_field_value_as_integer( const security_t *p_security, const char *field )
+/* Returns the code of value, or BLP_VALUE_CODE_NONE if no field has it. */
+blp_value_code_t blp_value_code( const char *value )
 {
-	const variant_t* p_variant = security_field_value( p_security, field );
-	long result = 0L;
+	blp_value_code_t result = BLP_VALUE_CODE_NONE;
+	void *code              = NULL;
 
-	ACQUIRE_LOCK( p_security );	
-	if( p_variant && p_variant->type == BLP_FIELD_TYPE_INTEGER )
+	SPIN_LOCK( &value_pool.lock );
+	if( value_pool.is_initialized && hash_map_find( &value_pool.codes, value, &code ) )
 	{
-		result = p_variant->value.integer;
+		result = (blp_value_code_t) (size_t) code;
 	}
-	RELEASE_LOCK( p_security );
+	SPIN_UNLOCK( &value_pool.lock );
 
 	return result;
 }
 
-boolean security_set_field_value_as_integer( security_t *p_security, const char *field, long value )
+const char* blp_value_string( blp_value_code_t code )
 {
-	field_t *p_field = NULL;
-	boolean result   = FALSE;
-	assert( p_security );
+	const char *result = NULL;
 
-	p_field = security_field( p_security, field );
-
-	ACQUIRE_LOCK( p_security );	
-	if( p_field )
+	SPIN_LOCK( &value_pool.lock );
+	if( code != BLP_VALUE_CODE_NONE && code <= value_pool.count )
 	{
-		assert( variant_is_type( &p_field->value, VARIANT_INTEGER ) );
+		result = value_pool.strings[ code ];
+	}
+	SPIN_UNLOCK( &value_pool.lock );
 
-		if( variant_is_string( &p_field->value ) )
-		{
-			free( variant_string( &p_field->value ) );
-		}
+	return result;
+}
 
-		variant_set_type( &p_field->value, VARIANT_INTEGER );
-		p_field->value.value.integer = value;
-		result = TRUE;
-	}
-	else
+/*
+ * Registers field as a decimal computed from other fields, for example
+ * blp_derived_field_add( "MID", "(BID + ASK) / 2" ). Expressions use + - *
+ * / and parentheses over field names and numbers, and may name other
+ * derived fields. A derived field is stored on the security like any
+ * other field and recomputed under the same lock whenever one of its
+ * inputs is updated. Registering a name again replaces its expression.
+ */
+boolean blp_derived_field_add( const char *field, const char *expression )
+{
+	derived_field_t derived;
+
+	assert( field );
+	assert( expression );
+
+	memset( &derived, 0, sizeof(derived) );
+	derived.key = field_key_intern( field );
+
+	if( !derived.key || !derived_parse( expression, &derived ) )
 	{
-		p_field = (field_t *) malloc( sizeof(field_t) );
+		return FALSE;
+	}
 
-		assert( p_security );
-		assert( field );
+	return derived_set_replace( derived.key, &derived );
+}
 
-		if( p_field )
-		{
-			char *field_copy = strdup(field);
-		
-			memset( p_field, 0, sizeof(field_t) );
+boolean blp_derived_field_remove( const char *field )
+{
+	const char *key = field_key_find( field );
 
-			if( !field_copy )
+	return key ? derived_set_replace( key, NULL ) : FALSE;
+}
+
+/*
+ * Forgets every derived field and frees the sets replaced so far. No
+ * updates may be in flight, as with blp_field_dictionary_unload().
+ */
+void blp_derived_field_clear( void )
+{
+	derived_set_t *p_set;
+
+	SPIN_LOCK( &derived_lock );
+	p_set = (derived_set_t *) ATOMIC_EXCHANGE_POINTER( &derived_fields, NULL );
+
+	while( p_set )
+	{
+		derived_set_t *p_retired = p_set->retired;
+		derived_set_free( p_set );
+		p_set = p_retired;
+	}
+	SPIN_UNLOCK( &derived_lock );
+}
+
+/*
+ * Publishes a copy of the registered set with key replaced by p_derived,
+ * or removed when p_derived is NULL. The copy is put in dependency order
+ * and rejected if the fields now depend on each other in a cycle.
+ */
+boolean derived_set_replace( const char *key, const derived_field_t *p_derived )
+{
+	derived_set_t *p_previous;
+	derived_set_t *p_set       = NULL;
+	derived_field_t *unordered = NULL;
+	unsigned char *state       = NULL;   /* 0 unvisited, 1 on the path, 2 placed */
+	size_t *stack              = NULL;
+	size_t *next_input         = NULL;
+	size_t capacity;
+	size_t count               = 0;
+	size_t placed              = 0;
+	boolean result             = FALSE;
+	size_t i;
+
+	SPIN_LOCK( &derived_lock );
+	p_previous = derived_fields;
+	capacity   = (p_previous ? p_previous->count : 0) + 1;
+
+	unordered  = (derived_field_t *) blp_malloc( sizeof(derived_field_t) * capacity );
+	p_set      = (derived_set_t *) blp_malloc( sizeof(derived_set_t) + sizeof(derived_field_t) * (capacity - 1) );
+	state      = (unsigned char *) blp_malloc( capacity );
+	stack      = (size_t *) blp_malloc( sizeof(size_t) * capacity );
+	next_input = (size_t *) blp_malloc( sizeof(size_t) * capacity );
+
+	if( !unordered || !p_set || !state || !stack || !next_input )
+	{
+		goto done;
+	}
+
+	p_set->inputs     = NULL;
+	p_set->input_mask = 0;
+	p_set->dependents = NULL;
+
+	for( i = 0; p_previous && i < p_previous->count; i++ )
+	{
+		if( p_previous->fields[ i ].key != key )
+		{
+			unordered[ count++ ] = p_previous->fields[ i ];
+		}
+	}
+
+	if( p_derived )
+	{
+		unordered[ count++ ] = *p_derived;
+	}
+	else if( !p_previous || count == p_previous->count )
+	{
+		/* nothing to remove */
+		goto done;
+	}
+
+	memset( state, 0, count );
+
+	/* depth-first, placing each field after the derived fields it reads */
+	for( i = 0; i < count; i++ )
+	{
+		size_t top = 0;
+
+		if( state[ i ] )
+		{
+			continue;
+		}
+
+		stack[ top++ ]  = i;
+		state[ i ]      = 1;
+		next_input[ i ] = 0;
+
+		while( top > 0 )
+		{
+			size_t current = stack[ top - 1 ];
+
+			if( next_input[ current ] < unordered[ current ].input_count )
 			{
-				free( p_field );
-				result = FALSE;
-				goto done;
-			}
+				const char *input = unordered[ current ].inputs[ next_input[ current ]++ ];
+				size_t j;
 
-			variant_set_type( &p_field->value, VARIANT_INTEGER );
-			p_field->value.value.integer = value;
+				for( j = 0; j < count && unordered[ j ].key != input; j++ )
+				{
+				}
 
-			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+				if( j == count || state[ j ] == 2 )
+				{
+					continue;
+				}
+
+				if( state[ j ] == 1 )
+				{
+					goto done;
+				}
+
+				stack[ top++ ]  = j;
+				state[ j ]      = 1;
+				next_input[ j ] = 0;
+			}
+			else
+			{
+				state[ current ]          = 2;
+				p_set->fields[ placed++ ] = unordered[ current ];
+				top--;
+			}
 		}
 	}
 
+	p_set->count   = placed;
+	p_set->retired = p_previous;
+
+	if( !derived_set_index( p_set ) )
+	{
+		goto done;
+	}
+
+	ATOMIC_EXCHANGE_POINTER( &derived_fields, p_set );
+	p_set  = NULL;
+	result = TRUE;
+
 done:
-	RELEASE_LOCK( p_security );
-	return result;
-}
+	SPIN_UNLOCK( &derived_lock );
 
-unsigned long security_field_value_as_uinteger( const security_t *p_security, const char *field )
-{
-	const variant_t* p_variant = security_field_value( p_security, field );
-	unsigned long result = 0L;
+	if( p_set )
+	{
+		derived_set_free( p_set );
+	}
 
-	ACQUIRE_LOCK( p_security );
-	if( p_variant && p_variant->type == BLP_FIELD_TYPE_UNSIGNED_INTEGER )
+	if( unordered )
 	{
-		result = p_variant->value.unsigned_integer;
+		blp_free( unordered );
+	}
+
+	if( state )
+	{
+		blp_free( state );
+	}
+
+	if( stack )
+	{
+		blp_free( stack );
+	}
+
+	if( next_input )
+	{
+		blp_free( next_input );
 	}
-	RELEASE_LOCK( p_security );
 
 	return result;
 }
 
-boolean security_set_field_value_as_uinteger( security_t *p_security, const char *field, unsigned long value )
+/*
+ * Builds the set's index from each input key to its dependents. Fields
+ * are already in dependency order, so one pass per key finds every field
+ * that reads the key or reads a derived field already found.
+ */
+boolean derived_set_index( derived_set_t *p_set )
 {
-	field_t *p_field = NULL;
-	boolean result   = FALSE;
-	assert( p_security );
+	size_t *sources           = NULL;   /* per field and input, the derived field read */
+	unsigned char *reached    = NULL;
+	size_t dependent_count    = 0;
+	size_t dependent_capacity = 0;
+	size_t capacity           = 2;
+	size_t input_total        = 0;
+	boolean result            = FALSE;
+	size_t i;
+	size_t k;
 
-	p_field = security_field( p_security, field );
+	for( i = 0; i < p_set->count; i++ )
+	{
+		input_total += p_set->fields[ i ].input_count;
+	}
 
-	ACQUIRE_LOCK( p_security );
-	if( p_field )
+	if( input_total == 0 )
 	{
-		assert( variant_is_type( &p_field->value, VARIANT_UNSIGNED_INTEGER ) );
+		return TRUE;
+	}
 
-		if( variant_is_string( &p_field->value ) )
-		{
-			free( variant_string( &p_field->value ) );
-		}
+	while( capacity < 2 * input_total )
+	{
+		capacity *= 2;
+	}
 
-		variant_set_type( &p_field->value, VARIANT_UNSIGNED_INTEGER );
-		p_field->value.value.unsigned_integer = value;
-		result = TRUE;
+	p_set->inputs = (derived_input_t *) blp_malloc( sizeof(derived_input_t) * capacity );
+	sources       = (size_t *) blp_malloc( sizeof(size_t) * DERIVED_MAX_INPUTS * p_set->count );
+	reached       = (unsigned char *) blp_malloc( p_set->count );
+
+	if( !p_set->inputs || !sources || !reached )
+	{
+		goto done;
 	}
-	else
+
+	memset( p_set->inputs, 0, sizeof(derived_input_t) * capacity );
+	p_set->input_mask = capacity - 1;
+
+	for( i = 0; i < p_set->count; i++ )
 	{
-		p_field = (field_t *) malloc( sizeof(field_t) );
+		for( k = 0; k < p_set->fields[ i ].input_count; k++ )
+		{
+			size_t j;
 
-		assert( p_security );
-		assert( field );
+			for( j = 0; j < i && p_set->fields[ j ].key != p_set->fields[ i ].inputs[ k ]; j++ )
+			{
+			}
 
-		if( p_field )
+			sources[ i * DERIVED_MAX_INPUTS + k ] = j < i ? j : DERIVED_NONE;
+		}
+	}
+
+	for( i = 0; i < p_set->count; i++ )
+	{
+		for( k = 0; k < p_set->fields[ i ].input_count; k++ )
 		{
-			char *field_copy = strdup(field);
-		
-			memset( p_field, 0, sizeof(field_t) );
+			const char *key = p_set->fields[ i ].inputs[ k ];
+			size_t slot     = field_key_hash( key ) & p_set->input_mask;
+			size_t m;
 
-			if( !field_copy )
+			while( p_set->inputs[ slot ].key && p_set->inputs[ slot ].key != key )
 			{
-				free( p_field );
-				result = FALSE;
-				goto done;
+				slot = (slot + 1) & p_set->input_mask;
 			}
 
-			variant_set_type( &p_field->value, VARIANT_UNSIGNED_INTEGER );
-			p_field->value.value.unsigned_integer = value;
+			if( p_set->inputs[ slot ].key )
+			{
+				continue;
+			}
 
-			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+			p_set->inputs[ slot ].key   = key;
+			p_set->inputs[ slot ].first = dependent_count;
+
+			for( m = 0; m < p_set->count; m++ )
+			{
+				size_t n;
+
+				reached[ m ] = FALSE;
+
+				for( n = 0; n < p_set->fields[ m ].input_count && !reached[ m ]; n++ )
+				{
+					size_t source = sources[ m * DERIVED_MAX_INPUTS + n ];
+
+					reached[ m ] = p_set->fields[ m ].inputs[ n ] == key || (source != DERIVED_NONE && reached[ source ]);
+				}
+
+				if( !reached[ m ] )
+				{
+					continue;
+				}
+
+				if( dependent_count == dependent_capacity )
+				{
+					size_t grown       = dependent_capacity ? 2 * dependent_capacity : 16;
+					size_t *dependents = (size_t *) blp_realloc( p_set->dependents, sizeof(size_t) * grown );
+
+					if( !dependents )
+					{
+						goto done;
+					}
+
+					p_set->dependents  = dependents;
+					dependent_capacity = grown;
+				}
+
+				p_set->dependents[ dependent_count++ ] = m;
+			}
+
+			p_set->inputs[ slot ].count = dependent_count - p_set->inputs[ slot ].first;
 		}
 	}
 
+	result = TRUE;
+
 done:
-	RELEASE_LOCK( p_security );
+	if( sources )
+	{
+		blp_free( sources );
+	}
+
+	if( reached )
+	{
+		blp_free( reached );
+	}
+
 	return result;
 }
 
-void* security_field_value_as_pointer( const security_t *p_security, const char *field )
+void derived_set_free( derived_set_t *p_set )
 {
-	const variant_t* p_variant = security_field_value( p_security, field );
-	void* result = NULL;
+	if( p_set->inputs )
+	{
+		blp_free( p_set->inputs );
+	}
 
-	ACQUIRE_LOCK( p_security );
-	if( p_variant && p_variant->type == BLP_FIELD_TYPE_POINTER )
+	if( p_set->dependents )
 	{
-		result = p_variant->value.pointer;
+		blp_free( p_set->dependents );
 	}
-	RELEASE_LOCK( p_security );
 
-	return result;
+	blp_free( p_set );
 }
 
-boolean security_set_field_value_as_pointer( security_t *p_security, const char *field, void* value )
+void derived_pending_begin( derived_pending_t *p_pending )
 {
-	field_t *p_field = NULL;
-	boolean result   = FALSE;
-	assert( p_security );
+	const derived_set_t *p_set = derived_fields;
 
-	p_field = security_field( p_security, field );
+	p_pending->p_set = p_set && p_set->inputs ? p_set : NULL;
+	p_pending->marks = NULL;
+	p_pending->first = 1;
+	p_pending->last  = 0;
 
-	ACQUIRE_LOCK( p_security );
-	if( p_field )
+	if( !p_pending->p_set )
 	{
-		assert( variant_is_type( &p_field->value, VARIANT_POINTER ) );
+		return;
+	}
+
+	/* without room for the marks every derived field is checked */
+	p_pending->marks = p_set->count <= DERIVED_MARKS_LOCAL ? p_pending->local : (unsigned char *) blp_malloc( p_set->count );
+
+	if( p_pending->marks )
+	{
+		memset( p_pending->marks, 0, p_set->count );
+	}
+}
+
+/* Marks the derived fields that depend on key, a canonical field key. */
+void derived_pending_add( derived_pending_t *p_pending, const char *key )
+{
+	const derived_set_t *p_set = p_pending->p_set;
+	size_t slot;
+	size_t i;
+
+	if( !p_set || !p_pending->marks || !key )
+	{
+		return;
+	}
 
-		if( variant_is_string( &p_field->value ) )
+	for( slot = field_key_hash( key ) & p_set->input_mask; p_set->inputs[ slot ].key; slot = (slot + 1) & p_set->input_mask )
+	{
+		if( p_set->inputs[ slot ].key == key )
 		{
-			free( variant_string( &p_field->value ) );
+			const derived_input_t *p_input = &p_set->inputs[ slot ];
+
+			if( p_input->count == 0 )
+			{
+				return;
+			}
+
+			for( i = 0; i < p_input->count; i++ )
+			{
+				p_pending->marks[ p_set->dependents[ p_input->first + i ] ] = TRUE;
+			}
+
+			if( p_pending->first > p_pending->last )
+			{
+				p_pending->first = p_set->dependents[ p_input->first ];
+				p_pending->last  = p_set->dependents[ p_input->first + p_input->count - 1 ];
+			}
+			else
+			{
+				if( p_set->dependents[ p_input->first ] < p_pending->first )
+				{
+					p_pending->first = p_set->dependents[ p_input->first ];
+				}
+
+				if( p_set->dependents[ p_input->first + p_input->count - 1 ] > p_pending->last )
+				{
+					p_pending->last = p_set->dependents[ p_input->first + p_input->count - 1 ];
+				}
+			}
+			return;
 		}
+	}
+}
 
-		variant_set_type( &p_field->value, VARIANT_POINTER );
-		p_field->value.value.pointer = value;
-		result = TRUE;
+boolean derived_parse( const char *expression, derived_field_t *p_derived )
+{
+	const char *text = expression;
+
+	if( !derived_parse_sum( &text, p_derived ) )
+	{
+		return FALSE;
 	}
-	else
+
+	while( isspace( (unsigned char) *text ) )
 	{
-		p_field = (field_t *) malloc( sizeof(field_t) );
+		text++;
+	}
 
-		assert( p_security );
-		assert( field );
-		assert( value );
+	/* the whole text has to be one expression */
+	if( *text != '\0' || p_derived->depth != 1 )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean derived_parse_sum( const char **p_text, derived_field_t *p_derived )
+{
+	if( !derived_parse_product( p_text, p_derived ) )
+	{
+		return FALSE;
+	}
+
+	for( ;; )
+	{
+		char op;
+
+		while( isspace( (unsigned char) **p_text ) )
+		{
+			(*p_text)++;
+		}
+
+		op = **p_text;
+
+		if( op != '+' && op != '-' )
+		{
+			return TRUE;
+		}
+
+		(*p_text)++;
+
+		if( !derived_parse_product( p_text, p_derived ) ||
+		    !derived_emit( p_derived, op == '+' ? DERIVED_ADD : DERIVED_SUBTRACT, 0, 0.0 ) )
+		{
+			return FALSE;
+		}
+	}
+}
+
+boolean derived_parse_product( const char **p_text, derived_field_t *p_derived )
+{
+	if( !derived_parse_unary( p_text, p_derived ) )
+	{
+		return FALSE;
+	}
+
+	for( ;; )
+	{
+		char op;
+
+		while( isspace( (unsigned char) **p_text ) )
+		{
+			(*p_text)++;
+		}
+
+		op = **p_text;
+
+		if( op != '*' && op != '/' )
+		{
+			return TRUE;
+		}
+
+		(*p_text)++;
+
+		if( !derived_parse_unary( p_text, p_derived ) ||
+		    !derived_emit( p_derived, op == '*' ? DERIVED_MULTIPLY : DERIVED_DIVIDE, 0, 0.0 ) )
+		{
+			return FALSE;
+		}
+	}
+}
+
+boolean derived_parse_unary( const char **p_text, derived_field_t *p_derived )
+{
+	const char *text = *p_text;
+
+	while( isspace( (unsigned char) *text ) )
+	{
+		text++;
+	}
+
+	if( *text == '-' )
+	{
+		*p_text = text + 1;
+		return derived_parse_unary( p_text, p_derived ) && derived_emit( p_derived, DERIVED_NEGATE, 0, 0.0 );
+	}
+
+	if( *text == '(' )
+	{
+		*p_text = text + 1;
+
+		if( !derived_parse_sum( p_text, p_derived ) )
+		{
+			return FALSE;
+		}
+
+		while( isspace( (unsigned char) **p_text ) )
+		{
+			(*p_text)++;
+		}
+
+		if( **p_text != ')' )
+		{
+			return FALSE;
+		}
+
+		(*p_text)++;
+		return TRUE;
+	}
+
+	if( isdigit( (unsigned char) *text ) || *text == '.' )
+	{
+		char number[ 64 ];
+		size_t length = 0;
+		double value;
+
+		while( (isdigit( (unsigned char) text[ length ] ) || text[ length ] == '.') && length < sizeof(number) - 1 )
+		{
+			number[ length ] = text[ length ];
+			length++;
+		}
+
+		number[ length ] = '\0';
+		*p_text          = text + length;
+
+		return parse_decimal( number, &value ) && derived_emit( p_derived, DERIVED_CONSTANT, 0, value );
+	}
+
+	if( isalpha( (unsigned char) *text ) || *text == '_' )
+	{
+		char name[ FIELD_KEY_MAX ];
+		const char *key;
+		size_t length = 0;
+		size_t input;
+
+		while( isalnum( (unsigned char) text[ length ] ) || text[ length ] == '_' )
+		{
+			if( length == sizeof(name) - 1 )
+			{
+				return FALSE;
+			}
+
+			name[ length ] = text[ length ];
+			length++;
+		}
+
+		name[ length ] = '\0';
+		*p_text        = text + length;
+		key            = field_key_intern( name );
+
+		if( !key || key == p_derived->key )
+		{
+			return FALSE;
+		}
+
+		for( input = 0; input < p_derived->input_count && p_derived->inputs[ input ] != key; input++ )
+		{
+		}
+
+		if( input == p_derived->input_count )
+		{
+			if( input == DERIVED_MAX_INPUTS )
+			{
+				return FALSE;
+			}
+
+			p_derived->inputs[ p_derived->input_count++ ] = key;
+		}
+
+		return derived_emit( p_derived, DERIVED_INPUT, (unsigned char) input, 0.0 );
+	}
+
+	return FALSE;
+}
+
+boolean derived_emit( derived_field_t *p_derived, unsigned char op, unsigned char input, double constant )
+{
+	derived_step_t *p_step;
+
+	if( p_derived->step_count == DERIVED_MAX_STEPS )
+	{
+		return FALSE;
+	}
+
+	/* operands push one value; binary operators pop two and push one */
+	if( op == DERIVED_INPUT || op == DERIVED_CONSTANT )
+	{
+		if( ++p_derived->depth > DERIVED_MAX_DEPTH )
+		{
+			return FALSE;
+		}
+	}
+	else if( op != DERIVED_NEGATE )
+	{
+		p_derived->depth--;
+	}
+
+	p_step           = &p_derived->steps[ p_derived->step_count++ ];
+	p_step->op       = op;
+	p_step->input    = input;
+	p_step->constant = constant;
+
+	return TRUE;
+}
+
+/* Runs the program; a division by zero or any non-finite result fails. */
+boolean derived_evaluate( const derived_field_t *p_derived, const double *inputs, double *p_result )
+{
+	double stack[ DERIVED_MAX_DEPTH ];
+	size_t top = 0;
+	size_t i;
+
+	for( i = 0; i < p_derived->step_count; i++ )
+	{
+		const derived_step_t *p_step = &p_derived->steps[ i ];
+
+		switch( p_step->op )
+		{
+			case DERIVED_INPUT:
+				stack[ top++ ] = inputs[ p_step->input ];
+				break;
+			case DERIVED_CONSTANT:
+				stack[ top++ ] = p_step->constant;
+				break;
+			case DERIVED_NEGATE:
+				stack[ top - 1 ] = -stack[ top - 1 ];
+				break;
+			case DERIVED_ADD:
+				top--;
+				stack[ top - 1 ] += stack[ top ];
+				break;
+			case DERIVED_SUBTRACT:
+				top--;
+				stack[ top - 1 ] -= stack[ top ];
+				break;
+			case DERIVED_MULTIPLY:
+				top--;
+				stack[ top - 1 ] *= stack[ top ];
+				break;
+			case DERIVED_DIVIDE:
+				top--;
+
+				if( stack[ top ] == 0.0 )
+				{
+					return FALSE;
+				}
+
+				stack[ top - 1 ] /= stack[ top ];
+				break;
+		}
+	}
+
+	*p_result = stack[ 0 ];
+	return *p_result == *p_result && *p_result != HUGE_VAL && *p_result != -HUGE_VAL;
+}
+
+/*
+ * Finds up to max fields whose mnemonic starts with prefix, in dictionary
+ * order. Mnemonics are upper case and sorted, so this is a binary search
+ * for the first match followed by a walk forward. Returns the number of
+ * ids written to results.
+ */
+size_t blp_field_search( const char *prefix, blp_field_id_t *results, size_t max )
+{
+	char key[ 128 ];
+	size_t length = 0;
+	size_t low    = 0;
+	size_t high   = BLP_FIELD_COUNT;
+	size_t count  = 0;
+
+	assert( prefix );
+	assert( results || max == 0 );
+
+	while( prefix[ length ] && length < sizeof(key) - 1 )
+	{
+		key[ length ] = (char) toupper( (unsigned char) prefix[ length ] );
+		length++;
+	}
+
+	key[ length ] = '\0';
+
+	if( prefix[ length ] )
+	{
+		return 0; /* longer than any mnemonic */
+	}
+
+	while( low < high )
+	{
+		size_t middle = low + (high - low) / 2;
+
+		if( strcmp( FIELD_MNEMONIC( middle ), key ) < 0 )
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	while( low < BLP_FIELD_COUNT && count < max && strncmp( FIELD_MNEMONIC( low ), key, length ) == 0 )
+	{
+		results[ count++ ] = (blp_field_id_t) low++;
+	}
+
+	return count;
+}
+
+/*
+ * Finds up to max fields whose description contains text, ignoring case.
+ * Only the ids in the trigram bucket with the fewest entries are checked;
+ * searches shorter than a trigram fall back to checking every field.
+ */
+size_t blp_field_search_description( const char *text, blp_field_id_t *results, size_t max )
+{
+	const field_trigram_index_t *p_index = NULL;
+	char search[ 256 ];
+	size_t length = 0;
+	size_t count  = 0;
+	size_t first  = 0;
+	size_t last   = BLP_FIELD_COUNT;
+	size_t i;
+
+	assert( text );
+	assert( results || max == 0 );
+
+	while( text[ length ] && length < sizeof(search) - 1 )
+	{
+		search[ length ] = (char) tolower( (unsigned char) text[ length ] );
+		length++;
+	}
+
+	search[ length ] = '\0';
+
+	if( text[ length ] )
+	{
+		return 0;
+	}
+
+	if( length >= 3 && (p_index = field_trigram_index( )) != NULL )
+	{
+		size_t smallest = (size_t) -1;
+
+		for( i = 0; i + 3 <= length; i++ )
+		{
+			size_t bucket = field_trigram_bucket( &search[ i ] );
+			size_t size   = p_index->offsets[ bucket + 1 ] - p_index->offsets[ bucket ];
+
+			if( size < smallest )
+			{
+				smallest = size;
+				first    = p_index->offsets[ bucket ];
+				last     = p_index->offsets[ bucket + 1 ];
+			}
+		}
+	}
+
+	for( i = first; i < last && count < max; i++ )
+	{
+		size_t id = p_index ? p_index->ids[ i ] : i;
+
+		if( field_text_contains( FIELD_DESCRIPTION( id ), search, length ) )
+		{
+			results[ count++ ] = (blp_field_id_t) id;
+		}
+	}
+
+	return count;
+}
+
+size_t field_trigram_bucket( const char *text )
+{
+	/* text is already lower case */
+	unsigned int trigram = ((unsigned char) text[ 0 ] << 16) | ((unsigned char) text[ 1 ] << 8) | (unsigned char) text[ 2 ];
+
+	return (trigram * 2654435761u) >> 16 & (FIELD_TRIGRAM_BUCKETS - 1);
+}
+
+const field_trigram_index_t* field_trigram_index( void )
+{
+	field_trigram_index_t *p_index = description_index;
+	unsigned int *last_ids         = NULL;
+	unsigned int *cursors          = NULL;
+	size_t pass;
+	size_t id;
+
+	if( p_index )
+	{
+		return p_index;
+	}
+
+	p_index  = (field_trigram_index_t *) blp_malloc( sizeof(field_trigram_index_t) );
+	last_ids = (unsigned int *) blp_malloc( FIELD_TRIGRAM_BUCKETS * sizeof(unsigned int) );
+
+	if( !p_index || !last_ids )
+	{
+		goto failed;
+	}
+
+	memset( p_index->offsets, 0, sizeof(p_index->offsets) );
+	p_index->ids = NULL;
+
+	/*
+	 * The first pass counts bucket sizes and the second fills them in.
+	 * last_ids keeps an id from landing in the same bucket twice.
+	 */
+	for( pass = 0; pass < 2; pass++ )
+	{
+		memset( last_ids, 0xFF, FIELD_TRIGRAM_BUCKETS * sizeof(unsigned int) );
+
+		for( id = 0; id < BLP_FIELD_COUNT; id++ )
+		{
+			const char *description = FIELD_DESCRIPTION( id );
+			char trigram[ 3 ];
+			size_t i;
+
+			for( i = 0; description[ i ]; i++ )
+			{
+				size_t bucket;
+
+				trigram[ 0 ] = trigram[ 1 ];
+				trigram[ 1 ] = trigram[ 2 ];
+				trigram[ 2 ] = (char) tolower( (unsigned char) description[ i ] );
+
+				if( i < 2 )
+				{
+					continue;
+				}
+
+				bucket = field_trigram_bucket( trigram );
+
+				if( last_ids[ bucket ] == (unsigned int) id )
+				{
+					continue;
+				}
+
+				last_ids[ bucket ] = (unsigned int) id;
+
+				if( pass == 0 )
+				{
+					p_index->offsets[ bucket + 1 ]++;
+				}
+				else
+				{
+					p_index->ids[ cursors[ bucket ]++ ] = (unsigned int) id;
+				}
+			}
+		}
+
+		if( pass == 0 )
+		{
+			size_t bucket;
+
+			for( bucket = 0; bucket < FIELD_TRIGRAM_BUCKETS; bucket++ )
+			{
+				p_index->offsets[ bucket + 1 ] += p_index->offsets[ bucket ];
+			}
+
+			p_index->ids = (unsigned int *) blp_malloc( p_index->offsets[ FIELD_TRIGRAM_BUCKETS ] * sizeof(unsigned int) + 1 );
+			cursors      = (unsigned int *) blp_malloc( FIELD_TRIGRAM_BUCKETS * sizeof(unsigned int) );
+
+			if( !p_index->ids || !cursors )
+			{
+				goto failed;
+			}
+
+			memcpy( cursors, p_index->offsets, FIELD_TRIGRAM_BUCKETS * sizeof(unsigned int) );
+		}
+	}
+
+	blp_free( cursors );
+	blp_free( last_ids );
+
+	/* Another thread may have built it first; keep whichever was published. */
+	if( ATOMIC_COMPARE_EXCHANGE_POINTER( &description_index, p_index, NULL ) != NULL )
+	{
+		blp_free( p_index->ids );
+		blp_free( p_index );
+	}
+
+	return description_index;
+
+failed:
+	if( p_index )
+	{
+		blp_free( p_index->ids );
+		blp_free( p_index );
+	}
+	blp_free( cursors );
+	blp_free( last_ids );
+	return NULL;
+}
+
+boolean field_text_contains( const char *text, const char *lowercase_search, size_t length )
+{
+	for( ; *text; text++ )
+	{
+		size_t i = 0;
+
+		while( i < length && text[ i ] && tolower( (unsigned char) text[ i ] ) == (unsigned char) lowercase_search[ i ] )
+		{
+			i++;
+		}
+
+		if( i == length )
+		{
+			return TRUE;
+		}
+	}
+
+	return length == 0;
+}
+
+/*
+ * Types observed on the wire win over the downloaded dictionary, which
+ * wins over the compiled-in one.
+ */
+unsigned char blp_field_type_by_id( blp_field_id_t id )
+{
+	const field_dictionary_t *p_dictionary = runtime_dictionary;
+	unsigned char type;
+
+	if( id >= BLP_FIELD_COUNT )
+	{
+		return BLP_FIELD_TYPE_NONE;
+	}
+
+	type = LEARNED_TYPES[ id ];
+
+	if( !type && p_dictionary )
+	{
+		type = p_dictionary->types[ id ];
+	}
+
+	return type ? type : FIELDS[ id ].type;
+}
+
+/*
+ * Most of the dictionary is typed as string. The first time such a field
+ * arrives its BLPAPI datatype decides how it is stored from then on.
+ */
+unsigned char blp_field_learn_type( blp_field_id_t id, const blpapi_Element_t *p_element )
+{
+	unsigned char type;
+
+	if( id >= BLP_FIELD_COUNT )
+	{
+		return BLP_FIELD_TYPE_NONE;
+	}
+
+	type = blp_field_type_by_id( id );
+
+	if( LEARNED_TYPES[ id ] || type != BLP_FIELD_TYPE_STRING || !learn_field_types || blpapi_Element_isNull( p_element ) )
+	{
+		return type;
+	}
+
+	switch( blpapi_Element_datatype( p_element ) )
+	{
+		case BLPAPI_DATATYPE_FLOAT64:
+		case BLPAPI_DATATYPE_FLOAT32:
+		case BLPAPI_DATATYPE_DECIMAL:
+		case BLPAPI_DATATYPE_INT64: /* long is 32 bits on Windows */
+			type = BLP_FIELD_TYPE_DECIMAL;
+			break;
+		case BLPAPI_DATATYPE_INT32:
+			type = BLP_FIELD_TYPE_INTEGER;
+			break;
+		default:
+			type = BLP_FIELD_TYPE_STRING;
+			break;
+	}
+
+	LEARNED_TYPES[ id ] = type;
+	return type;
+}
+
+void blp_set_field_type_learning( boolean enable )
+{
+	learn_field_types = enable;
+}
+
+/*
+ * The sidecar file is plain text, one "MNEMONIC TYPE" pair per line.
+ * Fields that are no longer in the dictionary and bad types are skipped.
+ */
+boolean blp_load_field_types( const char *filename )
+{
+	char line[ 256 ];
+	FILE *p_file;
+
+	assert( filename );
+	p_file = fopen( filename, "r" );
+
+	if( !p_file )
+	{
+		return FALSE;
+	}
+
+	while( fgets( line, sizeof(line), p_file ) )
+	{
+		char mnemonic[ 128 ];
+		unsigned int type;
+		blp_field_id_t id;
+
+		if( sscanf( line, "%127s %u", mnemonic, &type ) != 2 )
+		{
+			continue;
+		}
+
+		id = blp_field_id( mnemonic );
+
+		if( id != BLP_FIELD_ID_NONE && type >= BLP_FIELD_TYPE_STRING && type <= BLP_FIELD_TYPE_UNSIGNED_INTEGER )
+		{
+			LEARNED_TYPES[ id ] = (unsigned char) type;
+		}
+	}
+
+	fclose( p_file );
+	return TRUE;
+}
+
+/*
+ * Writes next to the target and renames over it, so a crash mid-write
+ * never leaves a truncated sidecar behind.
+ */
+boolean blp_save_field_types( const char *filename )
+{
+	char temporary[ 512 ];
+	boolean result = FALSE;
+	FILE *p_file;
+	size_t i;
+
+	assert( filename );
+
+	if( strlen( filename ) + 5 > sizeof(temporary) )
+	{
+		return FALSE;
+	}
+
+	sprintf( temporary, "%s.tmp", filename );
+	p_file = fopen( temporary, "w" );
+
+	if( !p_file )
+	{
+		return FALSE;
+	}
+
+	for( i = 0; i < BLP_FIELD_COUNT; i++ )
+	{
+		if( LEARNED_TYPES[ i ] && fprintf( p_file, "%s %u\n", FIELD_MNEMONIC( i ), (unsigned int) LEARNED_TYPES[ i ] ) < 0 )
+		{
+			fclose( p_file );
+			goto done;
+		}
+	}
+
+	if( fclose( p_file ) != 0 )
+	{
+		goto done;
+	}
+
+	#if defined(WIN32) || defined(WIN64)
+	result = MoveFileExA( temporary, filename, MOVEFILE_REPLACE_EXISTING ) != 0;
+	#else
+	result = rename( temporary, filename ) == 0;
+	#endif
+
+done:
+	if( !result )
+	{
+		remove( temporary );
+	}
+
+	return result;
+}
+
+const field_dictionary_entry_t* field_dictionary_find( const field_dictionary_t *p_dictionary, const char *field )
+{
+	size_t low  = 0;
+	size_t high;
+
+	if( !p_dictionary || !field )
+	{
+		return NULL;
+	}
+
+	high = p_dictionary->count;
+
+	while( low < high )
+	{
+		size_t middle                           = low + (high - low) / 2;
+		const field_dictionary_entry_t *p_entry = &p_dictionary->entries[ middle ];
+		int comparison                          = strcmp( field, p_dictionary->strings + p_entry->mnemonic );
+
+		if( comparison == 0 )
+		{
+			return p_entry;
+		}
+		else if( comparison < 0 )
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Maps a dictionary file and makes it current. Everything is checked
+ * before the swap: a truncated or foreign file is rejected and the
+ * current dictionary stays.
+ */
+boolean blp_field_dictionary_load( const char *filename )
+{
+	field_dictionary_t *p_dictionary           = NULL;
+	field_dictionary_t *p_previous             = NULL;
+	const field_dictionary_header_t *p_header  = NULL;
+	size_t size                                = 0;
+	size_t i;
+
+	assert( filename );
+
+	p_dictionary = (field_dictionary_t *) blp_malloc( sizeof(field_dictionary_t) );
+
+	if( !p_dictionary )
+	{
+		return FALSE;
+	}
+
+	memset( p_dictionary, 0, sizeof(field_dictionary_t) );
+
+	#if defined(WIN32) || defined(WIN64)
+	{
+		long long file_size = 0;
+
+		p_dictionary->file    = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+		p_dictionary->mapping = NULL;
+
+		if( p_dictionary->file == INVALID_HANDLE_VALUE || !GetFileSizeEx( p_dictionary->file, &file_size ) || file_size <= 0 )
+		{
+			goto failed;
+		}
+
+		size                  = (size_t) file_size;
+		p_dictionary->mapping = CreateFileMappingA( p_dictionary->file, NULL, PAGE_READONLY, 0, 0, NULL );
+
+		if( !p_dictionary->mapping )
+		{
+			goto failed;
+		}
+
+		p_dictionary->view = MapViewOfFile( p_dictionary->mapping, FILE_MAP_READ, 0, 0, 0 );
+	}
+	#else
+	{
+		struct stat info;
+		int fd = open( filename, O_RDONLY );
+		void *p_view;
+
+		if( fd < 0 )
+		{
+			goto failed;
+		}
+
+		if( fstat( fd, &info ) != 0 || info.st_size <= 0 )
+		{
+			close( fd );
+			goto failed;
+		}
+
+		size   = (size_t) info.st_size;
+		p_view = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+		close( fd );
+
+		p_dictionary->view = p_view != MAP_FAILED ? p_view : NULL;
+	}
+	#endif
+
+	if( !p_dictionary->view )
+	{
+		goto failed;
+	}
+
+	p_dictionary->size = size;
+	p_header           = (const field_dictionary_header_t *) p_dictionary->view;
+
+	if( size < sizeof(field_dictionary_header_t) ||
+	    memcmp( p_header->magic, FIELD_DICTIONARY_MAGIC, sizeof(p_header->magic) ) != 0 ||
+	    p_header->version != FIELD_DICTIONARY_VERSION ||
+	    p_header->strings_size == 0 ||
+	    p_header->count > (size - sizeof(field_dictionary_header_t)) / sizeof(field_dictionary_entry_t) ||
+	    size - sizeof(field_dictionary_header_t) - p_header->count * sizeof(field_dictionary_entry_t) < p_header->strings_size )
+	{
+		goto failed;
+	}
+
+	p_dictionary->count   = p_header->count;
+	p_dictionary->entries = (const field_dictionary_entry_t *) (p_header + 1);
+	p_dictionary->strings = (const char *) (p_dictionary->entries + p_header->count);
+
+	if( p_dictionary->strings[ p_header->strings_size - 1 ] != '\0' )
+	{
+		goto failed;
+	}
+
+	for( i = 0; i < p_dictionary->count; i++ )
+	{
+		const field_dictionary_entry_t *p_entry = &p_dictionary->entries[ i ];
+		blp_field_id_t id;
+
+		if( p_entry->mnemonic >= p_header->strings_size || p_entry->description >= p_header->strings_size ||
+		    p_entry->type > BLP_FIELD_TYPE_UNSIGNED_INTEGER )
+		{
+			goto failed;
+		}
+
+		/* lookups are a binary search, so the mnemonics must be sorted and unique */
+		if( i > 0 && strcmp( p_dictionary->strings + p_entry[ -1 ].mnemonic, p_dictionary->strings + p_entry->mnemonic ) >= 0 )
+		{
+			goto failed;
+		}
+
+		id = blp_field_id( p_dictionary->strings + p_entry->mnemonic );
+
+		if( id != BLP_FIELD_ID_NONE )
+		{
+			p_dictionary->types[ id ] = p_entry->type;
+		}
+	}
+
+	p_previous            = (field_dictionary_t *) ATOMIC_EXCHANGE_POINTER( &runtime_dictionary, p_dictionary );
+	p_dictionary->retired = p_previous;
+	return TRUE;
+
+failed:
+	field_dictionary_unmap( p_dictionary );
+	blp_free( p_dictionary );
+	return FALSE;
+}
+
+/*
+ * Only safe once nothing else is looking fields up, e.g. at shutdown.
+ */
+void blp_field_dictionary_unload( void )
+{
+	field_dictionary_t *p_dictionary = (field_dictionary_t *) ATOMIC_EXCHANGE_POINTER( &runtime_dictionary, NULL );
+
+	while( p_dictionary )
+	{
+		field_dictionary_t *p_retired = p_dictionary->retired;
+
+		field_dictionary_unmap( p_dictionary );
+		blp_free( p_dictionary );
+		p_dictionary = p_retired;
+	}
+}
+
+void field_dictionary_unmap( field_dictionary_t *p_dictionary )
+{
+	#if defined(WIN32) || defined(WIN64)
+	if( p_dictionary->view )
+	{
+		UnmapViewOfFile( p_dictionary->view );
+	}
+	if( p_dictionary->mapping )
+	{
+		CloseHandle( p_dictionary->mapping );
+	}
+	if( p_dictionary->file && p_dictionary->file != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( p_dictionary->file );
+	}
+	#else
+	if( p_dictionary->view )
+	{
+		munmap( (void *) p_dictionary->view, p_dictionary->size );
+	}
+	#endif
+
+	p_dictionary->view = NULL;
+}
+
+
+int debug_writer( const char* data, int length, void *stream )
+{
+	assert(data);
+	assert(stream);
+	return (int) fwrite(data, length, 1, (FILE *)stream);
+}
+
+
+static field_t*         security_field           ( const security_t *p_security, const char *field );
+static const variant_t* security_field_value     ( const security_t *p_security, const char *field );
+
+security_t* security_create( void )
+{
+	security_t *p_security = (security_t *) blp_malloc( sizeof(security_t) );
+	
+	#if defined(WIN32) || defined(WIN64)
+	InitializeCriticalSection( &p_security->crit_section );
+	#endif
+
+	ACQUIRE_LOCK( p_security );
+
+	if( p_security )
+	{
+		memset( &p_security->iterator, 0, sizeof(p_security->iterator) );
+
+		p_security->ticker         = NULL;
+		p_security->is_lazy        = FALSE;
+		p_security->is_fixed_point = FALSE;
+		p_security->p_arena        = NULL;
+		p_security->version        = 0;
+		p_security->p_snapshot     = NULL;
+		p_security->p_universe     = NULL;
+		p_security->universe_row   = UNIVERSE_TABLE_NONE;
+		p_security->p_alerts       = NULL;
+		p_security->p_alert_security = NULL;
+
+		/* keyed by canonical field pointers */
+		if( !hash_map_create( &p_security->fields, FIELDS_TABLE_LARGE, field_key_hash, security_fields_destroy, field_key_compare ) )
+		{
+			goto fields_failed;
+		}
+
+		tree_map_create( &p_security->overrides, security_overrides_destroy, field_key_compare );
+	}
+
+	
+	RELEASE_LOCK( p_security );
+	return p_security;
+
+fields_failed:
+	blp_free( p_security );
+	RELEASE_LOCK( p_security );
+	return NULL;
+}
+
+void security_destroy( security_t *p_security )
+{
+	ACQUIRE_LOCK( p_security );
+
+	assert( p_security );
+
+	if( p_security->ticker )
+	{
+		blp_free( p_security->ticker );
+	}
+
+	if( p_security->p_snapshot )
+	{
+		security_snapshot_release( p_security->p_snapshot );
+	}
+
+	if( p_security->p_universe )
+	{
+		universe_table_remove_row( p_security->p_universe, p_security->universe_row );
+	}
+
+	hash_map_destroy( &p_security->fields );
+	tree_map_destroy( &p_security->overrides );
+
+	if( p_security->p_arena )
+	{
+		arena_destroy( &p_security->p_arena->fields );
+		arena_destroy( &p_security->p_arena->strings );
+		blp_free( p_security->p_arena );
+	}
+
+	RELEASE_LOCK( p_security );
+	#if defined(WIN32) || defined(WIN64)
+	DeleteCriticalSection( &p_security->crit_section );
+	#endif
+
+	#if defined(_DEBUG)
+	memset( p_security, 0, sizeof(security_t) );
+	#endif
+
+	blp_free( p_security );
+}
+
+boolean security_fields_destroy( void *key, void *value )
+{
+	field_t *p_field = (field_t *) value;
+
+	assert( p_field );
+
+	/* key is a canonical field name, which the security does not own */
+	field_clear_value( p_field );
+	blp_free( p_field->raw );
+	blp_free( p_field );
+	return TRUE;
+}
+
+/* The field and arena strings go with the arena; only heap parts are freed. */
+boolean security_arena_fields_destroy( void *key, void *value )
+{
+	field_t *p_field = (field_t *) value;
+
+	assert( p_field );
+
+	field_clear_value( p_field );
+	blp_free( p_field->raw );
+	return TRUE;
+}
+
+boolean security_overrides_destroy( void *key, void *value )
+{
+	assert( key );
+	assert( value );
+	blp_free( value );
+	return TRUE;
+}
+
+const char* security_ticker( const security_t *p_security )
+{
+	assert( p_security );
+	return p_security->ticker;
+}
+
+void security_set_lazy( security_t *p_security, boolean is_lazy )
+{
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	p_security->is_lazy = is_lazy;
+	RELEASE_LOCK( p_security );
+}
+
+boolean security_is_lazy( const security_t *p_security )
+{
+	boolean result = FALSE;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	result = p_security->is_lazy;
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+void security_set_fixed_point( security_t *p_security, boolean is_fixed_point )
+{
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	p_security->is_fixed_point = is_fixed_point;
+	RELEASE_LOCK( p_security );
+}
+
+boolean security_is_fixed_point( const security_t *p_security )
+{
+	boolean result = FALSE;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	result = p_security->is_fixed_point;
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+/*
+ * With an arena, fields and their string values are carved out of a few
+ * large blocks and released in bulk by security_destroy(). String values
+ * are compacted into fresh blocks as old ones die, so a string returned
+ * by security_field_value_as_string() stays valid only until the next
+ * update of the security. Switching fails once the security has fields.
+ */
+boolean security_set_arena( security_t *p_security, boolean use_arena )
+{
+	security_arena_t *p_arena = NULL;
+	boolean result            = FALSE;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+
+	if( (p_security->p_arena != NULL) == (use_arena != FALSE) )
+	{
+		result = TRUE;
+		goto done;
+	}
+
+	if( hash_map_size( &p_security->fields ) > 0 )
+	{
+		goto done;
+	}
+
+	if( use_arena )
+	{
+		p_arena = (security_arena_t *) blp_malloc( sizeof(security_arena_t) );
+
+		if( !p_arena )
+		{
+			goto done;
+		}
+
+		arena_initialize( &p_arena->fields, SECURITY_ARENA_FIELD_BLOCK );
+		arena_initialize( &p_arena->strings, SECURITY_ARENA_STRING_BLOCK );
+		p_arena->compact_at = SECURITY_ARENA_COMPACT_MIN;
+	}
+
+	/* The destroy callback is fixed at creation, so the empty map is rebuilt. */
+	hash_map_destroy( &p_security->fields );
+
+	if( !hash_map_create( &p_security->fields, FIELDS_TABLE_LARGE, field_key_hash,
+	                      use_arena ? security_arena_fields_destroy : security_fields_destroy, field_key_compare ) )
+	{
+		/* leave a usable map behind */
+		hash_map_create( &p_security->fields, FIELDS_TABLE_LARGE, field_key_hash,
+		                 p_security->p_arena ? security_arena_fields_destroy : security_fields_destroy, field_key_compare );
+		blp_free( p_arena );
+		goto done;
+	}
+
+	if( p_security->p_arena )
+	{
+		arena_destroy( &p_security->p_arena->fields );
+		arena_destroy( &p_security->p_arena->strings );
+		blp_free( p_security->p_arena );
+	}
+
+	p_security->p_arena = p_arena;
+	result              = TRUE;
+
+done:
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+boolean security_has_arena( const security_t *p_security )
+{
+	boolean result = FALSE;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	result = p_security->p_arena != NULL;
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+/*
+ * Gives the security a row in a universe table, leaving any table it was
+ * in before, and copies its current values into the row. Market data
+ * then keeps the row up to date. Passing NULL takes it out of its table.
+ * It returns FALSE when the table has no free row.
+ */
+boolean security_set_universe( security_t *p_security, universe_table_t *p_universe )
+{
+	hash_map_iterator_t iter;
+	boolean result = TRUE;
+
+	assert( p_security );
+
+	ACQUIRE_LOCK( p_security );
+	if( p_security->p_universe != p_universe )
+	{
+		if( p_security->p_universe )
+		{
+			universe_table_remove_row( p_security->p_universe, p_security->universe_row );
+			p_security->p_universe   = NULL;
+			p_security->universe_row = UNIVERSE_TABLE_NONE;
+		}
+
+		if( p_universe )
+		{
+			size_t row = universe_table_add_row( p_universe, p_security->ticker );
+
+			if( row == UNIVERSE_TABLE_NONE )
+			{
+				result = FALSE;
+				goto done;
+			}
+
+			p_security->p_universe   = p_universe;
+			p_security->universe_row = row;
+
+			hash_map_iterator( &p_security->fields, &iter );
+
+			while( hash_map_iterator_next( &iter ) )
+			{
+				universe_table_store( p_universe, row, (const char *) hash_map_iterator_key( &iter ), (field_t *) hash_map_iterator_value( &iter ) );
+			}
+		}
+	}
+
+done:
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+/*
+ * Lets market data updates of the security fire the triggers registered
+ * for its ticker in an alert engine. NULL detaches it.
+ */
+boolean security_set_alerts( security_t *p_security, alert_engine_t *p_engine )
+{
+	alert_security_t *p_entry = NULL;
+
+	assert( p_security );
+
+	if( p_engine && (p_entry = alert_engine_entry( p_engine, p_security->ticker ? p_security->ticker : "" )) == NULL )
+	{
+		return FALSE;
+	}
+
+	ACQUIRE_LOCK( p_security );
+	p_security->p_alerts         = p_engine;
+	p_security->p_alert_security = p_entry;
+	RELEASE_LOCK( p_security );
+
+	return TRUE;
+}
+
+boolean security_set_ticker( security_t *p_security, const char *ticker )
+{
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	p_security->ticker = blp_strdup( ticker );
+	RELEASE_LOCK( p_security );
+
+	return p_security->ticker != NULL;
+}
+
+boolean security_has_field( const security_t *p_security, const char *field )
+{
+	const field_t *value;
+	boolean result = FALSE;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	result = hash_map_find( &p_security->fields, field_key_find( field ), (void **) &value );
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+size_t security_field_count( const security_t *p_security )
+{
+	size_t count = 0;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	count = hash_map_size( &p_security->fields );
+	RELEASE_LOCK( p_security );
+
+	return count;
+}
+
+field_t *security_field( const security_t *p_security, const char *field )
+{
+	field_t *value = NULL;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	hash_map_find( &p_security->fields, field_key_find( field ), (void **) &value );
+	RELEASE_LOCK( p_security );
+
+	return value;	
+}
+
+const variant_t* security_field_value( const security_t *p_security, const char *field )
+{
+	const field_t *p_field = NULL;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+
+	if( hash_map_find( &p_security->fields, field_key_find( field ), (void **) &p_field ) )
+	{
+		field_resolve( (field_t *) p_field );
+		RELEASE_LOCK( p_security );
+		return &p_field->value;
+	}
+
+	RELEASE_LOCK( p_security );
+	return NULL;	
+}
+
+unsigned short security_field_type( const security_t *p_security, const char *field )
+{
+	const field_t *p_field = NULL;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+
+	p_field = security_field( p_security, field );
+
+	if( p_field )
+	{
+		unsigned short type;
+
+		field_resolve( (field_t *) p_field );
+		type = p_field->type == BLP_FIELD_TYPE_FIXED ? BLP_FIELD_TYPE_FIXED : (unsigned short) variant_type( &p_field->value );
+		RELEASE_LOCK( p_security );
+		return type;
+	}
+
+	RELEASE_LOCK( p_security );
+	return BLP_FIELD_TYPE_NONE;
+}
+
+const char* security_field_value_as_string( const security_t *p_security, const char *field )
+{
+	const variant_t* p_variant = security_field_value( p_security, field );
+	const char* result = NULL;
+	
+	ACQUIRE_LOCK( p_security );
+	if( p_variant && p_variant->type == BLP_FIELD_TYPE_STRING )
+	{
+		result = p_variant->value.string;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_set_field_value_as_string( security_t *p_security, const char *field, const char *value )
+{
+	field_t *p_field = NULL;
+	boolean result   = FALSE;
+	assert( p_security );
+
+	p_field = security_field( p_security, field );
+
+	ACQUIRE_LOCK( p_security );
+	if( p_field )
+	{
+		field_resolve( p_field );
+		p_field->is_pending = FALSE;
+		p_field->type       = VARIANT_STRING;
+		assert( variant_is_type( &p_field->value, VARIANT_STRING ) );
+
+		field_clear_value( p_field );
+
+		result = string_conversion( value, p_field );
+	}
+	else
+	{
+		p_field = security_field_alloc( p_security );
+
+		assert( p_security );
+		assert( field );
+		assert( value );
+
+		if( p_field )
+		{
+			const char *field_copy = field_key_intern( field );
+		
+			memset( p_field, 0, sizeof(field_t) );
+
+			if( !field_copy )
+			{
+				security_field_free( p_security, p_field );
+				result = FALSE;
+				goto done;
+			}
+		
+			if( !string_conversion( value, p_field ) )
+			{
+				security_field_free( p_security, p_field );
+				result = FALSE;
+				goto done;
+			}
+
+			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		}
+	}
+
+done:
+	if( result )
+	{
+		security_field_changed( p_security, field, p_field );
+	}
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+double security_field_value_as_decimal( const security_t *p_security, const char *field )
+{
+	const variant_t* p_variant = security_field_value( p_security, field );
+	double result = 0.0;
+	
+	ACQUIRE_LOCK( p_security );
+	if( p_variant && p_variant->type == BLP_FIELD_TYPE_DECIMAL )
+	{
+		result = p_variant->value.decimal;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_set_field_value_as_decimal( security_t *p_security, const char *field, double value )
+{
+	field_t *p_field = NULL;
+	boolean result   = FALSE;
+	assert( p_security );
+
+	p_field = security_field( p_security, field );
+
+	ACQUIRE_LOCK( p_security );
+	if( p_field )
+	{
+		field_resolve( p_field );
+		p_field->is_pending = FALSE;
+		p_field->type       = VARIANT_DECIMAL;
+		assert( variant_is_type( &p_field->value, VARIANT_DECIMAL ) );
+
+		field_clear_value( p_field );
+
+		variant_set_type( &p_field->value, VARIANT_DECIMAL );
+		p_field->value.value.decimal = value;
+		result = TRUE;
+	}
+	else
+	{
+		p_field = security_field_alloc( p_security );
+
+		assert( p_security );
+		assert( field );
+
+		if( p_field )
+		{
+			const char *field_copy = field_key_intern( field );
+		
+			memset( p_field, 0, sizeof(field_t) );
+
+			if( !field_copy )
+			{
+				security_field_free( p_security, p_field );
+				result = FALSE;
+				goto done;
+			}
+
+			variant_set_type( &p_field->value, VARIANT_DECIMAL );
+			p_field->value.value.decimal = value;
+
+			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		}
+	}
+
+done:
+	if( result )
+	{
+		security_field_changed( p_security, field, p_field );
+	}
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+long security_field_value_as_integer( const security_t *p_security, const char *field )
+{
+	const variant_t* p_variant = security_field_value( p_security, field );
+	long result = 0L;
+
+	ACQUIRE_LOCK( p_security );	
+	if( p_variant && p_variant->type == BLP_FIELD_TYPE_INTEGER )
+	{
+		result = p_variant->value.integer;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_set_field_value_as_integer( security_t *p_security, const char *field, long value )
+{
+	field_t *p_field = NULL;
+	boolean result   = FALSE;
+	assert( p_security );
+
+	p_field = security_field( p_security, field );
+
+	ACQUIRE_LOCK( p_security );	
+	if( p_field )
+	{
+		field_resolve( p_field );
+		p_field->is_pending = FALSE;
+		p_field->type       = VARIANT_INTEGER;
+		assert( variant_is_type( &p_field->value, VARIANT_INTEGER ) );
+
+		field_clear_value( p_field );
+
+		variant_set_type( &p_field->value, VARIANT_INTEGER );
+		p_field->value.value.integer = value;
+		result = TRUE;
+	}
+	else
+	{
+		p_field = security_field_alloc( p_security );
+
+		assert( p_security );
+		assert( field );
+
+		if( p_field )
+		{
+			const char *field_copy = field_key_intern( field );
+		
+			memset( p_field, 0, sizeof(field_t) );
+
+			if( !field_copy )
+			{
+				security_field_free( p_security, p_field );
+				result = FALSE;
+				goto done;
+			}
+
+			variant_set_type( &p_field->value, VARIANT_INTEGER );
+			p_field->value.value.integer = value;
+
+			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		}
+	}
+
+done:
+	if( result )
+	{
+		security_field_changed( p_security, field, p_field );
+	}
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+unsigned long security_field_value_as_uinteger( const security_t *p_security, const char *field )
+{
+	const variant_t* p_variant = security_field_value( p_security, field );
+	unsigned long result = 0L;
+
+	ACQUIRE_LOCK( p_security );
+	if( p_variant && p_variant->type == BLP_FIELD_TYPE_UNSIGNED_INTEGER )
+	{
+		result = p_variant->value.unsigned_integer;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_set_field_value_as_uinteger( security_t *p_security, const char *field, unsigned long value )
+{
+	field_t *p_field = NULL;
+	boolean result   = FALSE;
+	assert( p_security );
+
+	p_field = security_field( p_security, field );
+
+	ACQUIRE_LOCK( p_security );
+	if( p_field )
+	{
+		field_resolve( p_field );
+		p_field->is_pending = FALSE;
+		p_field->type       = VARIANT_UNSIGNED_INTEGER;
+		assert( variant_is_type( &p_field->value, VARIANT_UNSIGNED_INTEGER ) );
+
+		field_clear_value( p_field );
+
+		variant_set_type( &p_field->value, VARIANT_UNSIGNED_INTEGER );
+		p_field->value.value.unsigned_integer = value;
+		result = TRUE;
+	}
+	else
+	{
+		p_field = security_field_alloc( p_security );
+
+		assert( p_security );
+		assert( field );
+
+		if( p_field )
+		{
+			const char *field_copy = field_key_intern( field );
+		
+			memset( p_field, 0, sizeof(field_t) );
+
+			if( !field_copy )
+			{
+				security_field_free( p_security, p_field );
+				result = FALSE;
+				goto done;
+			}
+
+			variant_set_type( &p_field->value, VARIANT_UNSIGNED_INTEGER );
+			p_field->value.value.unsigned_integer = value;
+
+			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		}
+	}
+
+done:
+	if( result )
+	{
+		security_field_changed( p_security, field, p_field );
+	}
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+long long security_field_value_as_fixed( const security_t *p_security, const char *field )
+{
+	const field_t *p_field = NULL;
+	long long result       = 0LL;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	if( hash_map_find( &p_security->fields, field_key_find( field ), (void **) &p_field ) )
+	{
+		field_resolve( (field_t *) p_field );
+
+		if( p_field->type == BLP_FIELD_TYPE_FIXED )
+		{
+			result = p_field->fixed;
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+unsigned char security_field_scale( const security_t *p_security, const char *field )
+{
+	const field_t *p_field = NULL;
+	unsigned char result   = 0;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	if( hash_map_find( &p_security->fields, field_key_find( field ), (void **) &p_field ) )
+	{
+		field_resolve( (field_t *) p_field );
+
+		if( p_field->type == BLP_FIELD_TYPE_FIXED )
+		{
+			result = p_field->scale;
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_set_field_value_as_fixed( security_t *p_security, const char *field, long long value, unsigned char scale )
+{
+	field_t *p_field = NULL;
+	field_t update;
+	boolean result   = FALSE;
+
+	assert( p_security );
+	assert( field );
+
+	field = field_key_intern( field );
+	memset( &update, 0, sizeof(update) );
+	update.type                = BLP_FIELD_TYPE_FIXED;
+	update.scale               = scale;
+	update.fixed               = value;
+	update.value.type          = VARIANT_DECIMAL;
+	update.value.value.decimal = fixed_to_decimal( value, scale );
+
+	ACQUIRE_LOCK( p_security );
+	p_field = security_field_for_update( p_security, field );
+
+	if( p_field )
+	{
+		field_assign( p_field, &update );
+		security_field_changed( p_security, field, p_field );
+		result = TRUE;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+/*
+ * Reads several fields under one acquisition of the security lock, so
+ * the values are consistent with each other. A missing field comes back
+ * as an uninitialized variant; the result is the number found. String
+ * values point into the security and change with it.
+ */
+size_t security_get_fields( const security_t *p_security, const blp_field_id_t *ids, size_t count, variant_t *values )
+{
+	const field_t *p_field = NULL;
+	size_t found           = 0;
+	size_t i;
+
+	assert( p_security );
+	assert( ids || count == 0 );
+	assert( values || count == 0 );
+
+	ACQUIRE_LOCK( p_security );
+	for( i = 0; i < count; i++ )
+	{
+		/* a dictionary id leads straight to its canonical key */
+		if( ids[ i ] < BLP_FIELD_COUNT && hash_map_find( &p_security->fields, FIELD_MNEMONIC( ids[ i ] ), (void **) &p_field ) )
+		{
+			field_resolve( (field_t *) p_field );
+			values[ i ] = p_field->value;
+			found++;
+		}
+		else
+		{
+			memset( &values[ i ], 0, sizeof(variant_t) );
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return found;
+}
+
+/*
+ * Like security_get_fields() for decimal and fixed-point fields. Fields
+ * that are missing or of another type read as 0.0 and are not counted.
+ */
+size_t security_get_decimals( const security_t *p_security, const blp_field_id_t *ids, size_t count, double *values )
+{
+	const field_t *p_field = NULL;
+	size_t found           = 0;
+	size_t i;
+
+	assert( p_security );
+	assert( ids || count == 0 );
+	assert( values || count == 0 );
+
+	ACQUIRE_LOCK( p_security );
+	for( i = 0; i < count; i++ )
+	{
+		values[ i ] = 0.0;
+
+		if( ids[ i ] < BLP_FIELD_COUNT && hash_map_find( &p_security->fields, FIELD_MNEMONIC( ids[ i ] ), (void **) &p_field ) )
+		{
+			field_resolve( (field_t *) p_field );
+
+			if( p_field->value.type == BLP_FIELD_TYPE_DECIMAL )
+			{
+				values[ i ] = p_field->value.value.decimal;
+				found++;
+			}
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return found;
+}
+
+/* Pool code of an enumerated field's value, BLP_VALUE_CODE_NONE otherwise. */
+blp_value_code_t security_field_value_code( const security_t *p_security, const char *field )
+{
+	const field_t *p_field  = NULL;
+	blp_value_code_t result = BLP_VALUE_CODE_NONE;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	if( hash_map_find( &p_security->fields, field_key_find( field ), (void **) &p_field ) )
+	{
+		field_resolve( (field_t *) p_field );
+
+		if( p_field->value_storage == FIELD_STORAGE_INTERNED )
+		{
+			result = p_field->code;
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+void* security_field_value_as_pointer( const security_t *p_security, const char *field )
+{
+	const variant_t* p_variant = security_field_value( p_security, field );
+	void* result = NULL;
+
+	ACQUIRE_LOCK( p_security );
+	if( p_variant && p_variant->type == BLP_FIELD_TYPE_POINTER )
+	{
+		result = p_variant->value.pointer;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_set_field_value_as_pointer( security_t *p_security, const char *field, void* value )
+{
+	field_t *p_field = NULL;
+	boolean result   = FALSE;
+	assert( p_security );
+
+	p_field = security_field( p_security, field );
+
+	ACQUIRE_LOCK( p_security );
+	if( p_field )
+	{
+		field_resolve( p_field );
+		p_field->is_pending = FALSE;
+		p_field->type       = VARIANT_POINTER;
+		assert( variant_is_type( &p_field->value, VARIANT_POINTER ) );
+
+		field_clear_value( p_field );
+
+		variant_set_type( &p_field->value, VARIANT_POINTER );
+		p_field->value.value.pointer = value;
+		result = TRUE;
+	}
+	else
+	{
+		p_field = security_field_alloc( p_security );
+
+		assert( p_security );
+		assert( field );
+		assert( value );
+
+		if( p_field )
+		{
+			const char *field_copy = field_key_intern( field );
+		
+			memset( p_field, 0, sizeof(field_t) );
+
+			if( !field_copy )
+			{
+				security_field_free( p_security, p_field );
+				result = FALSE;
+				goto done;
+			}
+
+			variant_set_type( &p_field->value, VARIANT_POINTER );
+			p_field->value.value.pointer = value;
+
+			result = hash_map_insert( &p_security->fields, field_copy, p_field );
+		}
+	}
+
+done:
+	if( result )
+	{
+		security_field_changed( p_security, field, p_field );
+	}
+	RELEASE_LOCK( p_security );
+	return result;
+}
+
+/*
+ * Stamps a field written outside the staged market data path, publishes
+ * it and recomputes what derives from it, so consumers never see a
+ * derived value without the write it came from. The caller holds the
+ * security lock.
+ */
+void security_field_changed( security_t *p_security, const char *field, field_t *p_field )
+{
+	const char *key  = field_key_find( field );
+
+	p_field->version = ++p_security->version;
+
+	if( key )
+	{
+		security_publish_field( p_security, key, p_field );
+	}
+
+	if( derived_fields )
+	{
+		derived_pending_t pending;
+
+		derived_pending_begin( &pending );
+		derived_pending_add( &pending, key );
+		security_update_derived( p_security, &pending, p_security->version - 1 );
+	}
+}
+
+field_t* security_field_alloc( security_t *p_security )
+{
+	/* caller holds the security lock */
+	if( p_security->p_arena )
+	{
+		return (field_t *) arena_alloc( &p_security->p_arena->fields, sizeof(field_t) );
+	}
+
+	return (field_t *) blp_malloc( sizeof(field_t) );
+}
+
+void security_field_free( security_t *p_security, field_t *p_field )
+{
+	/* an arena field is just abandoned; it is a few bytes until destroy */
+	if( !p_security->p_arena )
+	{
+		blp_free( p_field );
+	}
+}
+
+/*
+ * Copies a string value into the security's arena, compacting the arena
+ * first when enough of it has died. Caller holds the security lock.
+ */
+char* security_string_copy( security_t *p_security, const char *value )
+{
+	security_arena_t *p_arena = p_security->p_arena;
+	size_t length             = strlen( value ) + 1;
+	char *copy;
+
+	if( p_arena->strings.allocated + length > p_arena->compact_at )
+	{
+		security_arena_compact( p_security );
+	}
+
+	copy = (char *) arena_alloc( &p_arena->strings, length );
+
+	if( copy )
+	{
+		memcpy( copy, value, length );
+	}
+
+	return copy;
+}
+
+/*
+ * Moves the live string values into one new block and drops the old
+ * blocks. The block is sized up front so that moving cannot fail half
+ * way through.
+ */
+void security_arena_compact( security_t *p_security )
+{
+	security_arena_t *p_arena = p_security->p_arena;
+	size_t live               = 0;
+	hash_map_iterator_t iter;
+	arena_t strings;
+
+	hash_map_iterator( &p_security->fields, &iter );
+	while( hash_map_iterator_next( &iter ) )
+	{
+		field_t *p_field = (field_t *) hash_map_iterator_value( &iter );
+
+		if( p_field->value_storage == FIELD_STORAGE_ARENA && variant_is_string( &p_field->value ) )
+		{
+			live += ARENA_ALIGN( strlen( variant_string( &p_field->value ) ) + 1 );
+		}
+	}
+
+	if( live == 0 )
+	{
+		/* nothing left to move, so every block is garbage */
+		arena_destroy( &p_arena->strings );
+		p_arena->compact_at = SECURITY_ARENA_COMPACT_MIN;
+		return;
+	}
+
+	arena_initialize( &strings, live > SECURITY_ARENA_STRING_BLOCK ? live : SECURITY_ARENA_STRING_BLOCK );
+
+	if( !arena_alloc( &strings, live ) )
+	{
+		return; /* keep growing the old arena */
+	}
+
+	/* hand the reserved block out again, piece by piece */
+	strings.blocks->used = 0;
+	strings.allocated    = 0;
+
+	hash_map_iterator( &p_security->fields, &iter );
+	while( hash_map_iterator_next( &iter ) )
+	{
+		field_t *p_field = (field_t *) hash_map_iterator_value( &iter );
+
+		if( p_field->value_storage == FIELD_STORAGE_ARENA && variant_is_string( &p_field->value ) )
+		{
+			const char *value = variant_string( &p_field->value );
+			size_t length     = strlen( value ) + 1;
+			char *copy        = (char *) arena_alloc( &strings, length );
+
+			memcpy( copy, value, length );
+			p_field->value.value.string = copy;
+		}
+	}
+
+	arena_destroy( &p_arena->strings );
+	p_arena->strings    = strings;
+	p_arena->compact_at = 2 * live > SECURITY_ARENA_COMPACT_MIN ? 2 * live : SECURITY_ARENA_COMPACT_MIN;
+}
+
+field_t* security_field_for_update( security_t *p_security, const char *field )
+{
+	field_t *p_field = NULL;
+
+	/* caller holds the security lock and passes a canonical key */
+	if( hash_map_find( &p_security->fields, field, (void **) &p_field ) )
+	{
+		return p_field;
+	}
+
+	if( !field || (p_field = security_field_alloc( p_security )) == NULL )
+	{
+		return NULL;
+	}
+
+	memset( p_field, 0, sizeof(field_t) );
+
+	if( !hash_map_insert( &p_security->fields, field, p_field ) )
+	{
+		security_field_free( p_security, p_field );
+		return NULL;
+	}
+
+	return p_field;
+}
+
+unsigned char security_storage_type( const security_t *p_security, const char *field, unsigned char type, unsigned char scale )
+{
+	/* Decimal fields with a dictionary scale become fixed-point when asked to. */
+	if( type == VARIANT_DECIMAL && scale > 0 && p_security->is_fixed_point )
+	{
+		return BLP_FIELD_TYPE_FIXED;
+	}
+
+	if( type == BLP_FIELD_TYPE_STRING || type == BLP_FIELD_TYPE_NONE )
+	{
+		blp_field_id_t id = field_id_by_key( field );
+
+		if( id != BLP_FIELD_ID_NONE && INTERNED_FIELDS[ id ] )
+		{
+			return FIELD_TYPE_INTERNED;
+		}
+	}
+
+	return type;
+}
+
+boolean security_set_field_from_bb( security_t *p_security, const char *field, unsigned char type, unsigned char scale, const char *value )
+{
+	field_t *p_field = NULL;
+
+	assert( p_security );
+	assert( field );
+	assert( value );
+
+	ACQUIRE_LOCK( p_security );
+	p_field = security_store_from_bb( p_security, field, type, scale, value );
+
+	if( p_field )
+	{
+		security_field_changed( p_security, field, p_field );
+	}
+	RELEASE_LOCK( p_security );
+
+	return p_field != NULL;
+}
+
+/*
+ * Writes a Bloomberg string value into a field and returns the field, or
+ * NULL if the value was rejected. The caller holds the security lock and
+ * stamps the field's version.
+ */
+field_t* security_store_from_bb( security_t *p_security, const char *field, unsigned char type, unsigned char scale, const char *value )
+{
+	field_t *p_field = NULL;
+	field_t update;
+
+	type = security_storage_type( p_security, field, type, scale );
+
+	/* A lazy update is still checked here, so that it is rejected exactly
+	 * when an eager one would be and never buries the last good value.
+	 */
+	if( p_security->is_lazy )
+	{
+		if( !field_raw_is_valid( type, scale, value ) )
+		{
+			return NULL;
+		}
+
+		p_field = security_field_for_update( p_security, field );
+		return p_field && field_store_raw( p_field, type, scale, value ) ? p_field : NULL;
+	}
+
+	/* Convert first so that a value that fails to parse leaves the
+	 * previous one in place.
+	 */
+	memset( &update, 0, sizeof(update) );
+
+	if( p_security->p_arena && (type == BLP_FIELD_TYPE_STRING || type == BLP_FIELD_TYPE_NONE) &&
+	    strlen( value ) >= FIELD_INLINE_CAPACITY )
+	{
+		update.type                = VARIANT_STRING;
+		update.value.type          = VARIANT_STRING;
+		update.value.value.string  = security_string_copy( p_security, value );
+		update.value_storage       = FIELD_STORAGE_ARENA;
+
+		if( !update.value.value.string )
+		{
+			return NULL;
+		}
+	}
+	else if( !field_initialize( type, scale, value, &update ) )
+	{
+		return NULL;
+	}
+
+	return security_store_update( p_security, field, &update );
+}
+
+/*
+ * Moves an already converted value into a field and returns the field,
+ * or NULL if the field could not be created, in which case the value is
+ * released. The caller holds the security lock.
+ */
+field_t* security_store_update( security_t *p_security, const char *field, field_t *p_update )
+{
+	field_t *p_field = security_field_for_update( p_security, field );
+
+	if( p_field )
+	{
+		field_assign( p_field, p_update );
+	}
+	else
+	{
+		field_clear_value( p_update );
+	}
+
+	return p_field;
+}
+
+boolean security_set_field_from_element( security_t *p_security, const char *field, unsigned char type, unsigned char scale, const blpapi_Element_t *p_element )
+{
+	field_t *p_field   = NULL;
+	const char *string = NULL;
+	field_t update;
+	boolean result     = FALSE;
+
+	assert( p_element );
+
+	/* Native values are read outside of the lock. */
+	memset( &update, 0, sizeof(update) );
+
+	if( !field_initialize_from_element( security_storage_type( p_security, field, type, scale ), scale, p_element, &update, &string ) )
+	{
+		return FALSE;
+	}
+
+	if( string )
+	{
+		return security_set_field_from_bb( p_security, field, type, scale, string );
+	}
+
+	ACQUIRE_LOCK( p_security );
+	p_field = security_store_update( p_security, field, &update );
+
+	if( p_field )
+	{
+		security_field_changed( p_security, field, p_field );
+		result = TRUE;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+/*
+ * Converts a field of a market data message outside of the security lock
+ * and adds it to the message's staged updates. Values that arrive as text
+ * are kept as text and converted when the batch is applied.
+ */
+boolean security_stage_field( const security_t *p_security, staged_field_t *p_staged, const char *field, unsigned char type, unsigned char scale, const blpapi_Element_t *p_element )
+{
+	assert( p_staged );
+	assert( p_element );
+
+	memset( &p_staged->update, 0, sizeof(p_staged->update) );
+	p_staged->field  = field;
+	p_staged->type   = type;
+	p_staged->scale  = scale;
+	p_staged->string = NULL;
+
+	return field_initialize_from_element( security_storage_type( p_security, field, type, scale ), scale, p_element, &p_staged->update, &p_staged->string );
+}
+
+/*
+ * Publishes the staged fields of one message under a single acquisition
+ * of the security lock, so readers never see a bid from one message with
+ * an ask from the one before. Every field written gets the same version.
+ */
+void security_apply_staged( security_t *p_security, staged_field_t *staged, size_t count )
+{
+	derived_pending_t pending;
+	blp_version_t version;
+	boolean is_changed = FALSE;
+	size_t i;
+
+	assert( p_security );
+
+	ACQUIRE_LOCK( p_security );
+	version = p_security->version + 1;
+	derived_pending_begin( &pending );
+
+	for( i = 0; i < count; i++ )
+	{
+		field_t *p_field = staged[ i ].string ?
+		                   security_store_from_bb( p_security, staged[ i ].field, staged[ i ].type, staged[ i ].scale, staged[ i ].string ) :
+		                   security_store_update( p_security, staged[ i ].field, &staged[ i ].update );
+
+		if( p_field )
+		{
+			p_field->version = version;
+			is_changed       = TRUE;
+
+			security_publish_field( p_security, staged[ i ].field, p_field );
+			derived_pending_add( &pending, staged[ i ].field );
+		}
+	}
+
+	if( is_changed )
+	{
+		p_security->version = version;
+	}
+
+	/* also releases the marks */
+	security_update_derived( p_security, &pending, version - 1 );
+	RELEASE_LOCK( p_security );
+}
+
+/*
+ * Recomputes the pending derived fields with an input written after
+ * since, in dependency order, so one derived from another sees its new
+ * value. They are stamped with the current version. The caller holds the
+ * lock.
+ */
+void security_update_derived( security_t *p_security, derived_pending_t *p_pending, blp_version_t since )
+{
+	const derived_set_t *p_set = p_pending->p_set;
+	size_t i;
+
+	if( !p_set )
+	{
+		return;
+	}
+
+	if( !p_pending->marks )
+	{
+		p_pending->first = 0;
+		p_pending->last  = p_set->count - 1;
+	}
+
+	for( i = p_pending->first; i <= p_pending->last; i++ )
+	{
+		const derived_field_t *p_derived = &p_set->fields[ i ];
+		double inputs[ DERIVED_MAX_INPUTS ];
+		boolean is_changed = FALSE;
+		field_t *p_field   = NULL;
+		field_t update;
+		double result;
+		size_t j;
+
+		if( p_pending->marks && !p_pending->marks[ i ] )
+		{
+			continue;
+		}
+
+		for( j = 0; j < p_derived->input_count; j++ )
+		{
+			if( !hash_map_find( &p_security->fields, p_derived->inputs[ j ], (void **) &p_field ) ||
+			    !field_as_decimal( p_field, &inputs[ j ] ) )
+			{
+				break;
+			}
+
+			is_changed = is_changed || p_field->version > since;
+		}
+
+		if( j < p_derived->input_count || !is_changed || !derived_evaluate( p_derived, inputs, &result ) )
+		{
+			continue;
+		}
+
+		p_field = security_field_for_update( p_security, p_derived->key );
+
+		if( p_field )
+		{
+			memset( &update, 0, sizeof(update) );
+			update.type                = VARIANT_DECIMAL;
+			update.value.type          = VARIANT_DECIMAL;
+			update.value.value.decimal = result;
+
+			field_assign( p_field, &update );
+			p_field->version = p_security->version;
+
+			security_publish_field( p_security, p_derived->key, p_field );
+		}
+	}
+
+	if( p_pending->marks && p_pending->marks != p_pending->local )
+	{
+		blp_free( p_pending->marks );
+	}
+}
+
+/*
+ * Hands a written field to the consumers attached to the security. The
+ * caller holds the security lock.
+ */
+void security_publish_field( security_t *p_security, const char *key, field_t *p_field )
+{
+	alert_index_t *p_index = NULL;
+	double value;
+
+	if( p_security->p_universe )
+	{
+		universe_table_store( p_security->p_universe, p_security->universe_row, key, p_field );
+	}
+
+	/* only a field with triggers is converted, so lazy fields stay raw */
+	if( p_security->p_alert_security && p_security->p_alert_security->index_count > 0 &&
+	    (p_index = alert_security_index( p_security->p_alert_security, key )) != NULL &&
+	    field_as_decimal( p_field, &value ) )
+	{
+		alert_security_update( p_security->p_alerts, p_security->p_alert_security, p_index, value );
+	}
+}
+
+const char* security_first_field( security_t* p_security )
+{
+	const char* result = NULL;
+
+	ACQUIRE_LOCK( p_security );
+	hash_map_iterator( &p_security->fields, &p_security->iterator );
+
+	if( hash_map_iterator_next( &p_security->iterator ) )
+	{
+		result = (const char*) hash_map_iterator_key( &p_security->iterator );
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+const char* security_next_field( security_t* p_security )
+{
+	const char* result = NULL;
+
+	ACQUIRE_LOCK( p_security );
+	if( hash_map_iterator_next( &p_security->iterator ) )
+	{
+		result = (const char*) hash_map_iterator_key( &p_security->iterator );
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_field_cursor_open( const security_t *p_security, security_field_cursor_t *p_cursor )
+{
+	hash_map_iterator_t iter;
+	boolean result = TRUE;
+
+	assert( p_security );
+	assert( p_cursor );
+
+	p_cursor->p_security = p_security;
+	p_cursor->fields     = NULL;
+	p_cursor->count      = 0;
+	p_cursor->index      = 0;
+
+	ACQUIRE_LOCK( p_security );
+	if( hash_map_size( &p_security->fields ) > 0 )
+	{
+		p_cursor->fields = (const char **) blp_malloc( sizeof(const char*) * hash_map_size( &p_security->fields ) );
+
+		if( p_cursor->fields )
+		{
+			hash_map_iterator( (hash_map_t *) &p_security->fields, &iter );
+
+			/* canonical keys outlive the security, so copying them is enough */
+			while( hash_map_iterator_next( &iter ) )
+			{
+				p_cursor->fields[ p_cursor->count++ ] = (const char *) hash_map_iterator_key( &iter );
+			}
+		}
+		else
+		{
+			result = FALSE;
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+const char* security_field_cursor_next( security_field_cursor_t *p_cursor )
+{
+	assert( p_cursor );
+	return p_cursor->index < p_cursor->count ? p_cursor->fields[ p_cursor->index++ ] : NULL;
+}
+
+void security_field_cursor_close( security_field_cursor_t *p_cursor )
+{
+	assert( p_cursor );
+
+	if( p_cursor->fields )
+	{
+		blp_free( (void *) p_cursor->fields );
+	}
+
+	p_cursor->fields = NULL;
+	p_cursor->count  = 0;
+	p_cursor->index  = 0;
+}
+
+/*
+ * Calls visitor on every field with the security lock held throughout,
+ * so it sees one consistent set of values and may use the getters. It
+ * returns FALSE when the visitor stopped the walk.
+ */
+boolean security_for_each_field( const security_t *p_security, security_field_visitor visitor, void *context )
+{
+	hash_map_iterator_t iter;
+	boolean result = TRUE;
+
+	assert( p_security );
+	assert( visitor );
+
+	ACQUIRE_LOCK( p_security );
+	hash_map_iterator( (hash_map_t *) &p_security->fields, &iter );
+
+	while( result && hash_map_iterator_next( &iter ) )
+	{
+		result = visitor( p_security, (const char *) hash_map_iterator_key( &iter ), context );
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+/*
+ * The version of a security starts at 0 and goes up by one with every
+ * field update; a field's version is the security version it was last
+ * updated at. A consumer that remembers the version it last saw can skip
+ * a security that has not moved, and otherwise ask for just the fields
+ * that changed after it.
+ */
+blp_version_t security_version( const security_t *p_security )
+{
+	blp_version_t result;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	result = p_security->version;
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+blp_version_t security_field_version( const security_t *p_security, const char *field )
+{
+	const field_t *p_field = NULL;
+	blp_version_t result   = 0;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+	if( hash_map_find( &p_security->fields, field_key_find( field ), (void **) &p_field ) )
+	{
+		result = p_field->version;
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+/*
+ * Writes the names of up to max fields updated after version to fields,
+ * in no particular order, and returns how many there are in total; a
+ * result larger than max means the list was cut short.
+ */
+size_t security_changed_fields_since( const security_t *p_security, blp_version_t version, const char **fields, size_t max )
+{
+	hash_map_iterator_t iter;
+	size_t count = 0;
+
+	assert( p_security );
+	assert( fields || max == 0 );
+
+	ACQUIRE_LOCK( p_security );
+	if( p_security->version > version )
+	{
+		hash_map_iterator( (hash_map_t *) &p_security->fields, &iter );
+
+		while( hash_map_iterator_next( &iter ) )
+		{
+			const field_t *p_field = (const field_t *) hash_map_iterator_value( &iter );
+
+			if( p_field->version > version )
+			{
+				if( count < max )
+				{
+					fields[ count ] = (const char *) hash_map_iterator_key( &iter );
+				}
+
+				count++;
+			}
+		}
+	}
+	RELEASE_LOCK( p_security );
+
+	return count;
+}
+
+boolean security_add_override( security_t *p_security, const char *field, const char *value )
+{
+	boolean result = FALSE;	
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	const char *field_copy = field_key_intern( field );
+	const char *value_copy = blp_strdup( value );
+	result = field_copy && value_copy && tree_map_insert( &p_security->overrides, field_copy, value_copy );
+	if( !result )
+	{
+		blp_free( (void *) value_copy );
+	}
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_remove_override ( security_t *p_security, const char *field )
+{
+	boolean result = FALSE;	
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	result = tree_map_remove( &p_security->overrides, field_key_find( field ) );
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+boolean security_has_override( const security_t *p_security, const char *field )
+{
+	boolean result = FALSE;
+
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	void *value;
+	result = tree_map_find( &p_security->overrides, field_key_find( field ), &value );
+	RELEASE_LOCK( p_security );
+
+	return result;
+}
+
+void security_clear_overrides( security_t *p_security )
+{
+	ACQUIRE_LOCK( p_security );
+	assert( p_security );
+	tree_map_clear( &p_security->overrides );
+	RELEASE_LOCK( p_security );
+}
+
+/*
+ * Returns a reference to an immutable snapshot of the security, which
+ * the caller gives back with security_snapshot_release(). Reading a
+ * snapshot takes no locks, so a long calculation on one never holds up
+ * market data updates to the security. Until a field changes every
+ * call returns the same snapshot.
+ */
+security_snapshot_t* security_snapshot( security_t *p_security )
+{
+	security_snapshot_t *p_snapshot = NULL;
+
+	assert( p_security );
+	ACQUIRE_LOCK( p_security );
+
+	if( p_security->p_snapshot && p_security->p_snapshot->version == p_security->version )
+	{
+		p_snapshot = security_snapshot_retain( p_security->p_snapshot );
+	}
+	else
+	{
+		p_snapshot = security_snapshot_build( p_security );
+
+		if( p_snapshot )
+		{
+			if( p_security->p_snapshot )
+			{
+				security_snapshot_release( p_security->p_snapshot );
+			}
+
+			/* one reference for the security, one for the caller */
+			p_security->p_snapshot = security_snapshot_retain( p_snapshot );
+		}
+	}
+
+	RELEASE_LOCK( p_security );
+	return p_snapshot;
+}
+
+security_snapshot_t* security_snapshot_build( security_t *p_security )
+{
+	const security_snapshot_t *p_previous = p_security->p_snapshot;
+	security_snapshot_t *p_snapshot       = NULL;
+	size_t count                          = hash_map_size( &p_security->fields );
+	size_t i;
+	hash_map_iterator_t iter;
+
+	/* caller holds the security lock */
+	p_snapshot = (security_snapshot_t *) blp_malloc( sizeof(security_snapshot_t) + (count ? count - 1 : 0) * sizeof(snapshot_field_t) );
+
+	if( !p_snapshot )
+	{
+		return NULL;
+	}
+
+	p_snapshot->references = 1;
+	p_snapshot->version    = p_security->version;
+	p_snapshot->ticker     = NULL;
+	p_snapshot->count      = 0;
+
+	if( p_security->ticker && (p_snapshot->ticker = blp_strdup( p_security->ticker )) == NULL )
+	{
+		goto failed;
+	}
+
+	hash_map_iterator( &p_security->fields, &iter );
+
+	while( hash_map_iterator_next( &iter ) )
+	{
+		field_t *p_field         = (field_t *) hash_map_iterator_value( &iter );
+		snapshot_field_t *p_copy = &p_snapshot->fields[ p_snapshot->count ];
+
+		field_resolve( p_field );
+
+		p_copy->key       = (const char *) hash_map_iterator_key( &iter );
+		p_copy->version   = p_field->version;
+		p_copy->value     = p_field->value;
+		p_copy->type      = p_field->type;
+		p_copy->scale     = p_field->scale;
+		p_copy->fixed     = p_field->fixed;
+		p_copy->code      = p_field->code;
+		p_copy->p_string  = NULL;
+		p_copy->is_inline = FALSE;
+
+		if( variant_is_string( &p_field->value ) && variant_string( &p_field->value ) )
+		{
+			const snapshot_field_t *p_shared = p_previous ? security_snapshot_field( p_previous, p_copy->key ) : NULL;
+
+			switch( p_field->value_storage )
+			{
+				case FIELD_STORAGE_INTERNED:
+					/* pool strings live as long as the library */
+					break;
+				case FIELD_STORAGE_INLINE:
+					memcpy( p_copy->inline_value, p_field->inline_value, FIELD_INLINE_CAPACITY );
+					p_copy->is_inline = TRUE;
+					break;
+				default:
+					if( p_shared && p_shared->p_string && p_shared->version == p_field->version )
+					{
+						p_copy->p_string = p_shared->p_string;
+						ATOMIC_INCREMENT( &p_copy->p_string->references );
+					}
+					else
+					{
+						size_t length = strlen( variant_string( &p_field->value ) );
+
+						p_copy->p_string = (snapshot_string_t *) blp_malloc( sizeof(snapshot_string_t) + length );
+
+						if( !p_copy->p_string )
+						{
+							goto failed;
+						}
+
+						p_copy->p_string->references = 1;
+						memcpy( p_copy->p_string->text, variant_string( &p_field->value ), length + 1 );
+					}
+
+					p_copy->value.value.string = p_copy->p_string->text;
+					break;
+			}
+		}
+
+		p_snapshot->count++;
+	}
+
+	qsort( p_snapshot->fields, p_snapshot->count, sizeof(snapshot_field_t), snapshot_field_compare );
+
+	/* sorting moves the entries, so inline strings are pointed at their own copy afterwards */
+	for( i = 0; i < p_snapshot->count; i++ )
+	{
+		if( p_snapshot->fields[ i ].is_inline )
+		{
+			p_snapshot->fields[ i ].value.value.string = p_snapshot->fields[ i ].inline_value;
+		}
+	}
+
+	return p_snapshot;
+
+failed:
+	security_snapshot_release( p_snapshot );
+	return NULL;
+}
+
+security_snapshot_t* security_snapshot_retain( security_snapshot_t *p_snapshot )
+{
+	assert( p_snapshot );
+	ATOMIC_INCREMENT( &p_snapshot->references );
+	return p_snapshot;
+}
+
+void security_snapshot_release( security_snapshot_t *p_snapshot )
+{
+	size_t i;
+
+	if( !p_snapshot || ATOMIC_DECREMENT( &p_snapshot->references ) != 0 )
+	{
+		return;
+	}
+
+	for( i = 0; i < p_snapshot->count; i++ )
+	{
+		snapshot_string_t *p_string = p_snapshot->fields[ i ].p_string;
+
+		if( p_string && ATOMIC_DECREMENT( &p_string->references ) == 0 )
+		{
+			blp_free( p_string );
+		}
+	}
+
+	if( p_snapshot->ticker )
+	{
+		blp_free( p_snapshot->ticker );
+	}
+
+	blp_free( p_snapshot );
+}
+
+int snapshot_field_compare( const void *p_left, const void *p_right )
+{
+	const char *left  = ((const snapshot_field_t *) p_left)->key;
+	const char *right = ((const snapshot_field_t *) p_right)->key;
+
+	return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+const snapshot_field_t* security_snapshot_field( const security_snapshot_t *p_snapshot, const char *field )
+{
+	snapshot_field_t key;
+
+	assert( p_snapshot );
+	key.key = field_key_find( field );
+
+	if( !key.key )
+	{
+		return NULL;
+	}
+
+	return (const snapshot_field_t *) bsearch( &key, p_snapshot->fields, p_snapshot->count, sizeof(snapshot_field_t), snapshot_field_compare );
+}
+
+const char* security_snapshot_ticker( const security_snapshot_t *p_snapshot )
+{
+	assert( p_snapshot );
+	return p_snapshot->ticker;
+}
+
+blp_version_t security_snapshot_version( const security_snapshot_t *p_snapshot )
+{
+	assert( p_snapshot );
+	return p_snapshot->version;
+}
+
+size_t security_snapshot_field_count( const security_snapshot_t *p_snapshot )
+{
+	assert( p_snapshot );
+	return p_snapshot->count;
+}
+
+const char* security_snapshot_field_name( const security_snapshot_t *p_snapshot, size_t index )
+{
+	assert( p_snapshot );
+	return index < p_snapshot->count ? p_snapshot->fields[ index ].key : NULL;
+}
+
+boolean security_snapshot_has_field( const security_snapshot_t *p_snapshot, const char *field )
+{
+	return security_snapshot_field( p_snapshot, field ) != NULL;
+}
+
+unsigned short security_snapshot_field_type( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	if( !p_field )
+	{
+		return BLP_FIELD_TYPE_NONE;
+	}
+
+	return p_field->type == BLP_FIELD_TYPE_FIXED ? BLP_FIELD_TYPE_FIXED : (unsigned short) variant_type( &p_field->value );
+}
+
+const char* security_snapshot_value_as_string( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->value.type == BLP_FIELD_TYPE_STRING ? p_field->value.value.string : NULL;
+}
+
+double security_snapshot_value_as_decimal( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->value.type == BLP_FIELD_TYPE_DECIMAL ? p_field->value.value.decimal : 0.0;
+}
+
+long security_snapshot_value_as_integer( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->value.type == BLP_FIELD_TYPE_INTEGER ? p_field->value.value.integer : 0L;
+}
+
+unsigned long security_snapshot_value_as_uinteger( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->value.type == BLP_FIELD_TYPE_UNSIGNED_INTEGER ? p_field->value.value.unsigned_integer : 0UL;
+}
+
+long long security_snapshot_value_as_fixed( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->type == BLP_FIELD_TYPE_FIXED ? p_field->fixed : 0LL;
+}
+
+unsigned char security_snapshot_scale( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->type == BLP_FIELD_TYPE_FIXED ? p_field->scale : 0;
+}
+
+void* security_snapshot_value_as_pointer( const security_snapshot_t *p_snapshot, const char *field )
+{
+	const snapshot_field_t *p_field = security_snapshot_field( p_snapshot, field );
+
+	return p_field && p_field->value.type == BLP_FIELD_TYPE_POINTER ? p_field->value.value.pointer : NULL;
+}
+
+/*
+ * Creates a table with a column for each of the given dictionary fields
+ * and room for row_capacity securities. Attach it to a subscription with
+ * subscription_set_universe(), and detach it before destroying it.
+ */
+universe_table_t* universe_table_create( const blp_field_id_t *ids, size_t number_of_columns, size_t row_capacity )
+{
+	universe_table_t *p_universe = NULL;
+	size_t i;
+
+	assert( ids || number_of_columns == 0 );
+
+	for( i = 0; i < number_of_columns; i++ )
+	{
+		if( ids[ i ] >= BLP_FIELD_COUNT )
+		{
+			return NULL;
+		}
+	}
+
+	p_universe = (universe_table_t *) blp_malloc( sizeof(universe_table_t) );
+
+	if( !p_universe )
+	{
+		return NULL;
+	}
+
+	memset( p_universe, 0, sizeof(universe_table_t) );
+	p_universe->column_count    = number_of_columns;
+	p_universe->row_capacity    = row_capacity;
+	p_universe->validity_stride = (row_capacity + 7) / 8;
+
+	p_universe->ids      = (blp_field_id_t *) blp_malloc( sizeof(blp_field_id_t) * (number_of_columns + 1) );
+	p_universe->keys     = (const char **) blp_malloc( sizeof(const char*) * (number_of_columns + 1) );
+	p_universe->tickers  = (universe_ticker_t **) blp_malloc( sizeof(universe_ticker_t*) * (row_capacity + 1) );
+	p_universe->values   = (double *) blp_malloc( sizeof(double) * (number_of_columns * row_capacity + 1) );
+	p_universe->validity = (unsigned char *) blp_malloc( number_of_columns * p_universe->validity_stride + 1 );
+
+	if( !p_universe->ids || !p_universe->keys || !p_universe->tickers || !p_universe->values || !p_universe->validity )
+	{
+		universe_table_destroy( p_universe );
+		return NULL;
+	}
+
+	for( i = 0; i < number_of_columns; i++ )
+	{
+		p_universe->ids[ i ]  = ids[ i ];
+		p_universe->keys[ i ] = FIELD_MNEMONIC( ids[ i ] );
+	}
+
+	memset( p_universe->tickers, 0, sizeof(universe_ticker_t*) * row_capacity );
+	memset( p_universe->values, 0, sizeof(double) * number_of_columns * row_capacity );
+	memset( p_universe->validity, 0, number_of_columns * p_universe->validity_stride );
+
+	return p_universe;
+}
+
+void universe_table_destroy( universe_table_t *p_universe )
+{
+	size_t row;
+
+	if( !p_universe )
+	{
+		return;
+	}
+
+	if( p_universe->tickers )
+	{
+		for( row = 0; row < p_universe->row_count; row++ )
+		{
+			if( p_universe->tickers[ row ] )
+			{
+				blp_free( p_universe->tickers[ row ] );
+			}
+		}
+
+		blp_free( p_universe->tickers );
+	}
+
+	while( p_universe->retired )
+	{
+		universe_ticker_t *p_next = p_universe->retired->next;
+		blp_free( p_universe->retired );
+		p_universe->retired = p_next;
+	}
+
+	if( p_universe->ids )
+	{
+		blp_free( p_universe->ids );
+	}
+
+	if( p_universe->keys )
+	{
+		blp_free( (void *) p_universe->keys );
+	}
+
+	if( p_universe->values )
+	{
+		blp_free( p_universe->values );
+	}
+
+	if( p_universe->validity )
+	{
+		blp_free( p_universe->validity );
+	}
+
+	blp_free( p_universe );
+}
+
+size_t universe_table_add_row( universe_table_t *p_universe, const char *ticker )
+{
+	size_t length           = strlen( ticker ? ticker : "" );
+	universe_ticker_t *copy = (universe_ticker_t *) blp_malloc( sizeof(universe_ticker_t) + length );
+	size_t row              = UNIVERSE_TABLE_NONE;
+	size_t i;
+
+	if( !copy )
+	{
+		return UNIVERSE_TABLE_NONE;
+	}
+
+	copy->next = NULL;
+	memcpy( copy->text, ticker ? ticker : "", length + 1 );
+
+	SPIN_LOCK( &p_universe->lock );
+	for( i = 0; i < p_universe->row_count; i++ )
+	{
+		if( !p_universe->tickers[ i ] )
+		{
+			row = i;
+			break;
+		}
+	}
+
+	if( row == UNIVERSE_TABLE_NONE && p_universe->row_count < p_universe->row_capacity )
+	{
+		row = p_universe->row_count++;
+	}
+
+	if( row != UNIVERSE_TABLE_NONE )
+	{
+		p_universe->tickers[ row ] = copy;
+		copy = NULL;
+	}
+	SPIN_UNLOCK( &p_universe->lock );
+
+	if( copy )
+	{
+		blp_free( copy );
+	}
+
+	return row;
+}
+
+void universe_table_remove_row( universe_table_t *p_universe, size_t row )
+{
+	universe_ticker_t *p_ticker = NULL;
+	size_t column;
+
+	SPIN_LOCK( &p_universe->lock );
+	for( column = 0; column < p_universe->column_count; column++ )
+	{
+		p_universe->validity[ column * p_universe->validity_stride + row / 8 ] &= (unsigned char) ~(1u << (row % 8));
+	}
+
+	/* universe_table_ticker() may have handed the ticker out, so it is
+	 * retired rather than freed.
+	 */
+	p_ticker = p_universe->tickers[ row ];
+	p_universe->tickers[ row ] = NULL;
+
+	if( p_ticker )
+	{
+		p_ticker->next      = p_universe->retired;
+		p_universe->retired = p_ticker;
+	}
+	SPIN_UNLOCK( &p_universe->lock );
+}
+
+/*
+ * Copies a field into the security's row if the table has a column for
+ * it. Values that are not numeric leave the cell invalid. The caller
+ * holds the security lock.
+ */
+void universe_table_store( universe_table_t *p_universe, size_t row, const char *key, field_t *p_field )
+{
+	unsigned char *p_valid;
+	unsigned char bit = (unsigned char) (1u << (row % 8));
+	boolean is_valid;
+	double value      = 0.0;
+	size_t column;
+
+	/* tables have a handful of columns, so a scan beats a lookup table */
+	for( column = 0; column < p_universe->column_count && p_universe->keys[ column ] != key; column++ )
+	{
+	}
+
+	if( column == p_universe->column_count )
+	{
+		return;
+	}
+
+	is_valid = field_as_decimal( p_field, &value );
+	p_valid = &p_universe->validity[ column * p_universe->validity_stride + row / 8 ];
+
+	SPIN_LOCK( &p_universe->lock );
+	p_universe->values[ column * p_universe->row_capacity + row ] = value;
+	*p_valid = is_valid ? (unsigned char) (*p_valid | bit) : (unsigned char) (*p_valid & ~bit);
+	SPIN_UNLOCK( &p_universe->lock );
+}
+
+size_t universe_table_column_count( const universe_table_t *p_universe )
+{
+	assert( p_universe );
+	return p_universe->column_count;
+}
+
+/* Number of rows a scan has to cover; free rows are never valid. */
+size_t universe_table_row_count( const universe_table_t *p_universe )
+{
+	assert( p_universe );
+	return p_universe->row_count;
+}
+
+size_t universe_table_column( const universe_table_t *p_universe, blp_field_id_t id )
+{
+	size_t column;
+
+	assert( p_universe );
+
+	for( column = 0; column < p_universe->column_count; column++ )
+	{
+		if( p_universe->ids[ column ] == id )
+		{
+			return column;
+		}
+	}
+
+	return UNIVERSE_TABLE_NONE;
+}
+
+blp_field_id_t universe_table_column_field( const universe_table_t *p_universe, size_t column )
+{
+	assert( p_universe );
+	return column < p_universe->column_count ? p_universe->ids[ column ] : BLP_FIELD_ID_NONE;
+}
+
+/* The values of a column, indexed by row; only valid cells are meaningful. */
+const double* universe_table_values( const universe_table_t *p_universe, size_t column )
+{
+	assert( p_universe );
+	return column < p_universe->column_count ? &p_universe->values[ column * p_universe->row_capacity ] : NULL;
+}
+
+/* The validity bitmap of a column: row r is bit r % 8 of byte r / 8. */
+const unsigned char* universe_table_validity( const universe_table_t *p_universe, size_t column )
+{
+	assert( p_universe );
+	return column < p_universe->column_count ? &p_universe->validity[ column * p_universe->validity_stride ] : NULL;
+}
+
+boolean universe_table_is_valid( const universe_table_t *p_universe, size_t column, size_t row )
+{
+	assert( p_universe );
+
+	if( column >= p_universe->column_count || row >= p_universe->row_count )
+	{
+		return FALSE;
+	}
+
+	return (p_universe->validity[ column * p_universe->validity_stride + row / 8 ] >> (row % 8)) & 1;
+}
+
+/*
+ * Returns the ticker of a row, or NULL for a free row. It stays readable
+ * until the table is destroyed, even if the row is vacated or reused.
+ */
+const char* universe_table_ticker( const universe_table_t *p_universe, size_t row )
+{
+	const universe_ticker_t *p_ticker = NULL;
+
+	assert( p_universe );
+
+	if( row < p_universe->row_count )
+	{
+		p_ticker = p_universe->tickers[ row ];
+	}
+
+	return p_ticker ? p_ticker->text : NULL;
+}
+
+size_t column_sum_scalar( const double *values, const unsigned char *validity, size_t count, double *p_sum )
+{
+	double sum = 0.0;
+	size_t i;
+
+	if( !validity )
+	{
+		for( i = 0; i < count; i++ )
+		{
+			sum += values[ i ];
+		}
+
+		*p_sum = sum;
+		return count;
+	}
+
+	for( i = 0; i < count; i++ )
+	{
+		if( COLUMN_IS_VALID( validity, i ) )
+		{
+			sum += values[ i ];
+		}
+	}
+
+	*p_sum = sum;
+	return blp_column_count_valid( validity, count );
+}
+
+double column_squares_scalar( const double *values, const unsigned char *validity, size_t count, double mean )
+{
+	double sum = 0.0;
+	size_t i;
+
+	for( i = 0; i < count; i++ )
+	{
+		if( !validity || COLUMN_IS_VALID( validity, i ) )
+		{
+			double deviation = values[ i ] - mean;
+			sum += deviation * deviation;
+		}
+	}
+
+	return sum;
+}
+
+size_t column_min_max_scalar( const double *values, const unsigned char *validity, size_t count, double *p_min, double *p_max )
+{
+	double min  = HUGE_VAL;
+	double max  = -HUGE_VAL;
+	size_t seen = 0;
+	size_t i;
+
+	for( i = 0; i < count; i++ )
+	{
+		if( !validity || COLUMN_IS_VALID( validity, i ) )
+		{
+			min = values[ i ] < min ? values[ i ] : min;
+			max = values[ i ] > max ? values[ i ] : max;
+			seen++;
+		}
+	}
+
+	*p_min = min;
+	*p_max = max;
+	return seen;
+}
+
+static const column_kernels_t SCALAR_COLUMN_KERNELS = {
+	column_sum_scalar,
+	column_squares_scalar,
+	column_min_max_scalar
+};
+
+#if defined(BLP_COLUMN_AVX2)
+/* Lanes of four consecutive rows, all ones where the row's bit is set. */
+static TARGET_AVX2 __m256d column_lane_mask( const unsigned char *validity, size_t i )
+{
+	const __m256i bits  = _mm256_setr_epi64x( 1, 2, 4, 8 );
+	__m256i row_bits    = _mm256_set1_epi64x( (validity[ i / 8 ] >> (i % 8)) & 0xF );
+
+	return _mm256_castsi256_pd( _mm256_cmpeq_epi64( _mm256_and_si256( row_bits, bits ), bits ) );
+}
+
+/* Adds up the four lanes of v. */
+static TARGET_AVX2 double column_horizontal_sum( __m256d v )
+{
+	__m128d sum = _mm_add_pd( _mm256_castpd256_pd128( v ), _mm256_extractf128_pd( v, 1 ) );
+	return _mm_cvtsd_f64( _mm_add_sd( sum, _mm_unpackhi_pd( sum, sum ) ) );
+}
+
+TARGET_AVX2 size_t column_sum_avx2( const double *values, const unsigned char *validity, size_t count, double *p_sum )
+{
+	__m256d even = _mm256_setzero_pd( );
+	__m256d odd  = _mm256_setzero_pd( );
+	size_t tail  = count & ~(size_t) 7;
+	double sum;
+	size_t i;
+
+	/* two accumulators hide the latency of the adds */
+	for( i = 0; i < tail; i += 8 )
+	{
+		__m256d low  = _mm256_loadu_pd( &values[ i ] );
+		__m256d high = _mm256_loadu_pd( &values[ i + 4 ] );
+
+		if( validity )
+		{
+			low  = _mm256_and_pd( low, column_lane_mask( validity, i ) );
+			high = _mm256_and_pd( high, column_lane_mask( validity, i + 4 ) );
+		}
+
+		even = _mm256_add_pd( even, low );
+		odd  = _mm256_add_pd( odd, high );
+	}
+
+	sum = column_horizontal_sum( _mm256_add_pd( even, odd ) );
+
+	for( ; i < count; i++ )
+	{
+		if( !validity || COLUMN_IS_VALID( validity, i ) )
+		{
+			sum += values[ i ];
+		}
+	}
+
+	*p_sum = sum;
+	return validity ? blp_column_count_valid( validity, count ) : count;
+}
+
+TARGET_AVX2 double column_squares_avx2( const double *values, const unsigned char *validity, size_t count, double mean )
+{
+	const __m256d center = _mm256_set1_pd( mean );
+	__m256d even         = _mm256_setzero_pd( );
+	__m256d odd          = _mm256_setzero_pd( );
+	size_t tail          = count & ~(size_t) 7;
+	double sum;
+	size_t i;
+
+	for( i = 0; i < tail; i += 8 )
+	{
+		__m256d low  = _mm256_sub_pd( _mm256_loadu_pd( &values[ i ] ), center );
+		__m256d high = _mm256_sub_pd( _mm256_loadu_pd( &values[ i + 4 ] ), center );
+
+		if( validity )
+		{
+			low  = _mm256_and_pd( low, column_lane_mask( validity, i ) );
+			high = _mm256_and_pd( high, column_lane_mask( validity, i + 4 ) );
+		}
+
+		even = _mm256_add_pd( even, _mm256_mul_pd( low, low ) );
+		odd  = _mm256_add_pd( odd, _mm256_mul_pd( high, high ) );
+	}
+
+	sum = column_horizontal_sum( _mm256_add_pd( even, odd ) );
+
+	for( ; i < count; i++ )
+	{
+		if( !validity || COLUMN_IS_VALID( validity, i ) )
+		{
+			double deviation = values[ i ] - mean;
+			sum += deviation * deviation;
+		}
+	}
+
+	return sum;
+}
+
+TARGET_AVX2 size_t column_min_max_avx2( const double *values, const unsigned char *validity, size_t count, double *p_min, double *p_max )
+{
+	const __m256d positive = _mm256_set1_pd( HUGE_VAL );
+	const __m256d negative = _mm256_set1_pd( -HUGE_VAL );
+	__m256d min            = positive;
+	__m256d max            = negative;
+	size_t tail            = count & ~(size_t) 3;
+	double lanes[ 4 ];
+	size_t i;
+
+	for( i = 0; i < tail; i += 4 )
+	{
+		__m256d v = _mm256_loadu_pd( &values[ i ] );
+
+		if( validity )
+		{
+			/* invalid rows become the identity of each reduction */
+			__m256d mask = column_lane_mask( validity, i );
+
+			min = _mm256_min_pd( min, _mm256_blendv_pd( positive, v, mask ) );
+			max = _mm256_max_pd( max, _mm256_blendv_pd( negative, v, mask ) );
+		}
+		else
+		{
+			min = _mm256_min_pd( min, v );
+			max = _mm256_max_pd( max, v );
+		}
+	}
+
+	_mm256_storeu_pd( lanes, min );
+	*p_min = lanes[ 0 ];
+	for( i = 1; i < 4; i++ )
+	{
+		*p_min = lanes[ i ] < *p_min ? lanes[ i ] : *p_min;
+	}
+
+	_mm256_storeu_pd( lanes, max );
+	*p_max = lanes[ 0 ];
+	for( i = 1; i < 4; i++ )
+	{
+		*p_max = lanes[ i ] > *p_max ? lanes[ i ] : *p_max;
+	}
+
+	for( i = tail; i < count; i++ )
+	{
+		if( !validity || COLUMN_IS_VALID( validity, i ) )
+		{
+			*p_min = values[ i ] < *p_min ? values[ i ] : *p_min;
+			*p_max = values[ i ] > *p_max ? values[ i ] : *p_max;
+		}
+	}
+
+	return validity ? blp_column_count_valid( validity, count ) : count;
+}
+
+static const column_kernels_t AVX2_COLUMN_KERNELS = {
+	column_sum_avx2,
+	column_squares_avx2,
+	column_min_max_avx2
+};
+
+boolean column_cpu_has_avx2( void )
+{
+	#if defined(_MSC_VER)
+	int info[ 4 ];
+
+	__cpuid( info, 0 );
+
+	if( info[ 0 ] < 7 )
+	{
+		return FALSE;
+	}
+
+	/* the OS has to save the YMM registers as well */
+	__cpuid( info, 1 );
+
+	if( !(info[ 2 ] & (1 << 27)) || !(info[ 2 ] & (1 << 28)) || (_xgetbv( 0 ) & 6) != 6 )
+	{
+		return FALSE;
+	}
+
+	__cpuidex( info, 7, 0 );
+	return (info[ 1 ] & (1 << 5)) != 0;
+	#else
+	__builtin_cpu_init( );
+	return __builtin_cpu_supports( "avx2" ) != 0;
+	#endif
+}
+#endif
+
+const column_kernels_t* column_kernels( void )
+{
+	const column_kernels_t *p_kernels = active_column_kernels;
+
+	if( !p_kernels )
+	{
+		p_kernels = &SCALAR_COLUMN_KERNELS;
+
+		#if defined(BLP_COLUMN_AVX2)
+		if( column_cpu_has_avx2( ) )
+		{
+			p_kernels = &AVX2_COLUMN_KERNELS;
+		}
+		#endif
+
+		/* every thread picks the same table, so any of them may publish it */
+		ATOMIC_EXCHANGE_POINTER( &active_column_kernels, (column_kernels_t *) p_kernels );
+	}
+
+	return p_kernels;
+}
+
+/* Number of bits set among the first count rows of a validity bitmap. */
+size_t blp_column_count_valid( const unsigned char *validity, size_t count )
+{
+	size_t result = 0;
+	size_t bytes  = count / 8;
+	size_t i;
+
+	assert( validity || count == 0 );
+
+	for( i = 0; i < bytes; i++ )
+	{
+		unsigned int bits = validity[ i ];
+
+		bits    = bits - ((bits >> 1) & 0x55);
+		bits    = (bits & 0x33) + ((bits >> 2) & 0x33);
+		result += (bits + (bits >> 4)) & 0x0F;
+	}
+
+	for( i = bytes * 8; i < count; i++ )
+	{
+		result += COLUMN_IS_VALID( validity, i );
+	}
+
+	return result;
+}
+
+/*
+ * The reductions below cover the first count values; when validity is
+ * not NULL only rows whose bit is set take part. A column without any
+ * such rows reduces to 0.0.
+ */
+double blp_column_sum( const double *values, const unsigned char *validity, size_t count )
+{
+	double sum = 0.0;
+
+	assert( values || count == 0 );
+	column_kernels( )->sum( values, validity, count, &sum );
+	return sum;
+}
+
+double blp_column_mean( const double *values, const unsigned char *validity, size_t count )
+{
+	double sum = 0.0;
+	size_t n;
+
+	assert( values || count == 0 );
+	n = column_kernels( )->sum( values, validity, count, &sum );
+	return n ? sum / (double) n : 0.0;
+}
+
+double blp_column_min( const double *values, const unsigned char *validity, size_t count )
+{
+	double min = 0.0;
+	double max = 0.0;
+
+	assert( values || count == 0 );
+	return column_kernels( )->min_max( values, validity, count, &min, &max ) ? min : 0.0;
+}
+
+double blp_column_max( const double *values, const unsigned char *validity, size_t count )
+{
+	double min = 0.0;
+	double max = 0.0;
+
+	assert( values || count == 0 );
+	return column_kernels( )->min_max( values, validity, count, &min, &max ) ? max : 0.0;
+}
+
+/* Population standard deviation, computed in two passes for accuracy. */
+double blp_column_stddev( const double *values, const unsigned char *validity, size_t count )
+{
+	const column_kernels_t *p_kernels = column_kernels( );
+	double sum = 0.0;
+	size_t n;
+
+	assert( values || count == 0 );
+	n = p_kernels->sum( values, validity, count, &sum );
+
+	if( n == 0 )
+	{
+		return 0.0;
+	}
+
+	return sqrt( p_kernels->squares( values, validity, count, sum / (double) n ) / (double) n );
+}
+
+/*
+ * Creates an alert engine whose queue holds queue_capacity fired alerts,
+ * rounded up to a power of two. Alerts that find the queue full are
+ * counted by alert_engine_dropped(). Attach it to a subscription with
+ * subscription_set_alerts(), and detach it before destroying it.
+ */
+alert_engine_t* alert_engine_create( size_t queue_capacity )
+{
+	alert_engine_t *p_engine = (alert_engine_t *) blp_malloc( sizeof(alert_engine_t) );
+	size_t capacity          = 2;
+	size_t i;
+
+	if( !p_engine )
+	{
+		return NULL;
+	}
+
+	while( capacity < queue_capacity && capacity < ((size_t) 1 << 30) )
+	{
+		capacity <<= 1;
+	}
+
+	memset( p_engine, 0, sizeof(alert_engine_t) );
+	p_engine->cells = (alert_cell_t *) blp_malloc( sizeof(alert_cell_t) * capacity );
+	p_engine->mask  = (unsigned long) (capacity - 1);
+
+	if( !p_engine->cells )
+	{
+		blp_free( p_engine );
+		return NULL;
+	}
+
+	/* a cell is free for position p while its sequence is p */
+	for( i = 0; i < capacity; i++ )
+	{
+		p_engine->cells[ i ].sequence = (long) i;
+	}
+
+	#if defined(WIN32) || defined(WIN64)
+	InitializeCriticalSection( &p_engine->crit_section );
+	#endif
+
+	tree_map_create( &p_engine->securities, alert_engine_entries_destroy, (tree_map_compare_function) strcasecmp );
+
+	return p_engine;
+}
+
+void alert_engine_destroy( alert_engine_t *p_engine )
+{
+	if( !p_engine )
+	{
+		return;
+	}
+
+	tree_map_destroy( &p_engine->securities );
+
+	if( p_engine->registrations )
+	{
+		blp_free( p_engine->registrations );
+	}
+
+	blp_free( p_engine->cells );
+
+	#if defined(WIN32) || defined(WIN64)
+	DeleteCriticalSection( &p_engine->crit_section );
+	#endif
+
+	blp_free( p_engine );
+}
+
+boolean alert_engine_entries_destroy( void *p_key, void *p_value )
+{
+	/* p_key is the entry's ticker */
+	alert_security_t *p_entry = (alert_security_t *) p_value;
+	long i;
+
+	for( i = 0; i < p_entry->index_count; i++ )
+	{
+		alert_index_t *p_index = p_entry->indexes[ i ];
+
+		if( p_index->rising )
+		{
+			blp_free( p_index->rising );
+		}
+
+		if( p_index->falling )
+		{
+			blp_free( p_index->falling );
+		}
+
+		blp_free( p_index );
+	}
+
+	if( p_entry->indexes )
+	{
+		blp_free( p_entry->indexes );
+	}
+
+	blp_free( p_entry->ticker );
+	blp_free( p_entry );
+	return TRUE;
+}
+
+/* Finds or creates the triggers of a ticker; entries live as long as the engine. */
+alert_security_t* alert_engine_entry( alert_engine_t *p_engine, const char *ticker )
+{
+	alert_security_t *p_entry = NULL;
+
+	ACQUIRE_LOCK( p_engine );
+	if( !tree_map_find( &p_engine->securities, ticker, (void **) &p_entry ) )
+	{
+		p_entry = (alert_security_t *) blp_malloc( sizeof(alert_security_t) );
+
+		if( p_entry )
+		{
+			memset( p_entry, 0, sizeof(alert_security_t) );
+			p_entry->ticker = blp_strdup( ticker );
+
+			if( !p_entry->ticker || !tree_map_insert( &p_engine->securities, p_entry->ticker, p_entry ) )
+			{
+				if( p_entry->ticker )
+				{
+					blp_free( p_entry->ticker );
+				}
+
+				blp_free( p_entry );
+				p_entry = NULL;
+			}
+		}
+	}
+	RELEASE_LOCK( p_engine );
+
+	return p_entry;
+}
+
+/*
+ * Registers a trigger on a field of a ticker and returns its id, or
+ * BLP_ALERT_ID_NONE. BLP_ALERT_ABOVE and BLP_ALERT_BELOW also fire on the
+ * first value seen when it is already past the threshold; crossings need
+ * a previous value. context is handed back with every alert it fires.
+ */
+blp_alert_id_t alert_engine_add( alert_engine_t *p_engine, const char *ticker, const char *field, unsigned char kind, double threshold, void *context )
+{
+	alert_security_t *p_entry = NULL;
+	alert_index_t *p_index    = NULL;
+	alert_threshold_t trigger;
+	blp_alert_id_t result     = BLP_ALERT_ID_NONE;
+	const char *key;
+	size_t slot;
+	long i;
+
+	assert( p_engine );
+	assert( ticker );
+
+	key = field_key_intern( field );
+
+	if( !key || kind < BLP_ALERT_ABOVE || kind > BLP_ALERT_CROSSES || threshold != threshold ||
+	    (p_entry = alert_engine_entry( p_engine, ticker )) == NULL )
+	{
+		return BLP_ALERT_ID_NONE;
+	}
+
+	/* a freed slot first; it is only taken off the list once the trigger is in */
+	ACQUIRE_LOCK( p_engine );
+	if( p_engine->free_registration )
+	{
+		slot = p_engine->free_registration - 1;
+	}
+	else
+	{
+		if( p_engine->registration_count == ALERT_SLOT_MAX )
+		{
+			goto done;
+		}
+
+		if( p_engine->registration_count == p_engine->registration_capacity )
+		{
+			size_t capacity = p_engine->registration_capacity ? p_engine->registration_capacity * 2 : 64;
+			alert_registration_t *registrations = (alert_registration_t *) blp_realloc( p_engine->registrations, sizeof(alert_registration_t) * capacity );
+
+			if( !registrations )
+			{
+				goto done;
+			}
+
+			p_engine->registrations         = registrations;
+			p_engine->registration_capacity = capacity;
+		}
+
+		slot = p_engine->registration_count;
+		p_engine->registrations[ slot ].generation = 0;
+	}
+
+	trigger.threshold = threshold;
+	trigger.id        = ALERT_ID( slot, p_engine->registrations[ slot ].generation );
+	trigger.kind      = kind;
+	trigger.context   = context;
+
+	SPIN_LOCK( &p_entry->lock );
+	for( i = 0; i < p_entry->index_count && p_entry->indexes[ i ]->key != key; i++ )
+	{
+	}
+
+	if( i < p_entry->index_count )
+	{
+		p_index = p_entry->indexes[ i ];
+	}
+	else
+	{
+		if( (size_t) p_entry->index_count == p_entry->index_capacity )
+		{
+			size_t capacity         = p_entry->index_capacity ? p_entry->index_capacity * 2 : 4;
+			alert_index_t **indexes = (alert_index_t **) blp_realloc( p_entry->indexes, sizeof(alert_index_t*) * capacity );
+
+			if( !indexes )
+			{
+				SPIN_UNLOCK( &p_entry->lock );
+				goto done;
+			}
+
+			p_entry->indexes        = indexes;
+			p_entry->index_capacity = capacity;
+		}
+
+		p_index = (alert_index_t *) blp_malloc( sizeof(alert_index_t) );
+
+		if( !p_index )
+		{
+			SPIN_UNLOCK( &p_entry->lock );
+			goto done;
+		}
+
+		memset( p_index, 0, sizeof(alert_index_t) );
+		p_index->key = key;
+		p_entry->indexes[ p_entry->index_count++ ] = p_index;
+	}
+
+	if( (kind & BLP_ALERT_ABOVE) && !alert_thresholds_insert( &p_index->rising, &p_index->rising_count, &p_index->rising_capacity, &trigger ) )
+	{
+		SPIN_UNLOCK( &p_entry->lock );
+		goto done;
+	}
+
+	if( (kind & BLP_ALERT_BELOW) && !alert_thresholds_insert( &p_index->falling, &p_index->falling_count, &p_index->falling_capacity, &trigger ) )
+	{
+		if( kind & BLP_ALERT_ABOVE )
+		{
+			alert_thresholds_remove( p_index->rising, &p_index->rising_count, trigger.id, threshold );
+		}
+
+		SPIN_UNLOCK( &p_entry->lock );
+		goto done;
+	}
+	SPIN_UNLOCK( &p_entry->lock );
+
+	if( p_engine->free_registration )
+	{
+		p_engine->free_registration = p_engine->registrations[ slot ].next_free;
+	}
+	else
+	{
+		p_engine->registration_count++;
+	}
+
+	p_engine->registrations[ slot ].p_entry   = p_entry;
+	p_engine->registrations[ slot ].key       = key;
+	p_engine->registrations[ slot ].threshold = threshold;
+	p_engine->registrations[ slot ].kind      = kind;
+	p_engine->registrations[ slot ].is_active = TRUE;
+	p_engine->registrations[ slot ].next_free = 0;
+	result = trigger.id;
+
+done:
+	RELEASE_LOCK( p_engine );
+	return result;
+}
+
+/* Removes a trigger; its slot is reused and its id is never valid again. */
+boolean alert_engine_remove( alert_engine_t *p_engine, blp_alert_id_t id )
+{
+	alert_registration_t *p_registration;
+	size_t slot    = (size_t) (id & ALERT_SLOT_MASK);
+	boolean result = FALSE;
+	long i;
+
+	assert( p_engine );
+
+	ACQUIRE_LOCK( p_engine );
+	if( slot == 0 || slot > p_engine->registration_count || !p_engine->registrations[ slot - 1 ].is_active ||
+	    ALERT_ID( slot - 1, p_engine->registrations[ slot - 1 ].generation ) != id )
+	{
+		goto done;
+	}
+
+	p_registration = &p_engine->registrations[ slot - 1 ];
+
+	SPIN_LOCK( &p_registration->p_entry->lock );
+	for( i = 0; i < p_registration->p_entry->index_count; i++ )
+	{
+		alert_index_t *p_index = p_registration->p_entry->indexes[ i ];
+
+		if( p_index->key == p_registration->key )
+		{
+			if( p_registration->kind & BLP_ALERT_ABOVE )
+			{
+				alert_thresholds_remove( p_index->rising, &p_index->rising_count, id, p_registration->threshold );
+			}
+
+			if( p_registration->kind & BLP_ALERT_BELOW )
+			{
+				alert_thresholds_remove( p_index->falling, &p_index->falling_count, id, p_registration->threshold );
+			}
+			break;
+		}
+	}
+	SPIN_UNLOCK( &p_registration->p_entry->lock );
+
+	p_registration->is_active   = FALSE;
+	p_registration->p_entry     = NULL;
+	p_registration->generation++;
+	p_registration->next_free   = p_engine->free_registration;
+	p_engine->free_registration = slot;
+	result = TRUE;
+
+done:
+	RELEASE_LOCK( p_engine );
+	return result;
+}
+
+/* Index of the first threshold at or above value, or strictly above it. */
+size_t alert_thresholds_lower_bound( const alert_threshold_t *thresholds, size_t count, double value, boolean is_inclusive )
+{
+	size_t low  = 0;
+	size_t high = count;
+
+	while( low < high )
+	{
+		size_t middle = low + (high - low) / 2;
+
+		if( thresholds[ middle ].threshold < value || (!is_inclusive && thresholds[ middle ].threshold == value) )
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+boolean alert_thresholds_insert( alert_threshold_t **p_thresholds, size_t *p_count, size_t *p_capacity, const alert_threshold_t *p_threshold )
+{
+	size_t position;
+
+	if( *p_count == *p_capacity )
+	{
+		size_t capacity               = *p_capacity ? *p_capacity * 2 : 4;
+		alert_threshold_t *thresholds = (alert_threshold_t *) blp_realloc( *p_thresholds, sizeof(alert_threshold_t) * capacity );
+
+		if( !thresholds )
+		{
+			return FALSE;
+		}
+
+		*p_thresholds = thresholds;
+		*p_capacity   = capacity;
+	}
+
+	position = alert_thresholds_lower_bound( *p_thresholds, *p_count, p_threshold->threshold, FALSE );
+	memmove( &(*p_thresholds)[ position + 1 ], &(*p_thresholds)[ position ], sizeof(alert_threshold_t) * (*p_count - position) );
+	(*p_thresholds)[ position ] = *p_threshold;
+	(*p_count)++;
+
+	return TRUE;
+}
+
+void alert_thresholds_remove( alert_threshold_t *thresholds, size_t *p_count, blp_alert_id_t id, double threshold )
+{
+	size_t position = alert_thresholds_lower_bound( thresholds, *p_count, threshold, TRUE );
+
+	while( position < *p_count && thresholds[ position ].threshold == threshold )
+	{
+		if( thresholds[ position ].id == id )
+		{
+			memmove( &thresholds[ position ], &thresholds[ position + 1 ], sizeof(alert_threshold_t) * (*p_count - position - 1) );
+			(*p_count)--;
+			return;
+		}
+
+		position++;
+	}
+}
+
+/*
+ * Finds the triggers of one field of a ticker, or NULL. An index lives as
+ * long as the engine, so it can be used after the lock is dropped.
+ */
+alert_index_t* alert_security_index( alert_security_t *p_entry, const char *key )
+{
+	alert_index_t *p_index = NULL;
+	long i;
+
+	SPIN_LOCK( &p_entry->lock );
+	for( i = 0; i < p_entry->index_count; i++ )
+	{
+		if( p_entry->indexes[ i ]->key == key )
+		{
+			p_index = p_entry->indexes[ i ];
+			break;
+		}
+	}
+	SPIN_UNLOCK( &p_entry->lock );
+
+	return p_index;
+}
+
+/*
+ * Fires the triggers of one field that value has moved through since the
+ * previous update. Only the thresholds between the two values are
+ * visited.
+ */
+void alert_security_update( alert_engine_t *p_engine, alert_security_t *p_entry, alert_index_t *p_index, double value )
+{
+	size_t i;
+
+	SPIN_LOCK( &p_entry->lock );
+	if( p_index->has_last )
+	{
+		if( value > p_index->last )
+		{
+			/* rising through [last, value) */
+			for( i = alert_thresholds_lower_bound( p_index->rising, p_index->rising_count, p_index->last, TRUE );
+			     i < p_index->rising_count && p_index->rising[ i ].threshold < value;
+			     i++ )
+			{
+				alert_engine_push( p_engine, p_entry, p_index, &p_index->rising[ i ], BLP_ALERT_ABOVE, value );
+			}
+		}
+		else if( value < p_index->last )
+		{
+			/* falling through (value, last] */
+			for( i = alert_thresholds_lower_bound( p_index->falling, p_index->falling_count, value, FALSE );
+			     i < p_index->falling_count && p_index->falling[ i ].threshold <= p_index->last;
+			     i++ )
+			{
+				alert_engine_push( p_engine, p_entry, p_index, &p_index->falling[ i ], BLP_ALERT_BELOW, value );
+			}
+		}
+	}
+	else
+	{
+		/* the first value only fires levels it is already past */
+		for( i = 0; i < p_index->rising_count && p_index->rising[ i ].threshold < value; i++ )
+		{
+			if( p_index->rising[ i ].kind != BLP_ALERT_CROSSES )
+			{
+				alert_engine_push( p_engine, p_entry, p_index, &p_index->rising[ i ], BLP_ALERT_ABOVE, value );
+			}
+		}
+
+		for( i = alert_thresholds_lower_bound( p_index->falling, p_index->falling_count, value, FALSE ); i < p_index->falling_count; i++ )
+		{
+			if( p_index->falling[ i ].kind != BLP_ALERT_CROSSES )
+			{
+				alert_engine_push( p_engine, p_entry, p_index, &p_index->falling[ i ], BLP_ALERT_BELOW, value );
+			}
+		}
+	}
+
+	p_index->last     = value;
+	p_index->has_last = TRUE;
+	SPIN_UNLOCK( &p_entry->lock );
+}
+
+/*
+ * Bounded multi-producer queue: a producer claims a position by bumping
+ * enqueue_position, fills the cell and then publishes it by moving the
+ * cell's sequence past the position. No thread ever waits on another.
+ */
+void alert_engine_push( alert_engine_t *p_engine, const alert_security_t *p_entry, const alert_index_t *p_index, const alert_threshold_t *p_threshold, unsigned char direction, double value )
+{
+	unsigned long position = (unsigned long) ATOMIC_LOAD( &p_engine->enqueue_position );
+	alert_cell_t *p_cell;
+
+	for( ;; )
+	{
+		long difference;
+
+		p_cell     = &p_engine->cells[ position & p_engine->mask ];
+		difference = (long) ((unsigned long) ATOMIC_LOAD( &p_cell->sequence ) - position);
+
+		if( difference == 0 )
+		{
+			unsigned long claimed = (unsigned long) ATOMIC_COMPARE_EXCHANGE( &p_engine->enqueue_position, (long) (position + 1), (long) position );
+
+			if( claimed == position )
+			{
+				break;
+			}
+
+			position = claimed;
+		}
+		else if( difference < 0 )
+		{
+			/* full; the consumer has fallen behind */
+			ATOMIC_INCREMENT( &p_engine->dropped );
+			return;
+		}
+		else
+		{
+			position = (unsigned long) ATOMIC_LOAD( &p_engine->enqueue_position );
+		}
+	}
+
+	p_cell->alert.id        = p_threshold->id;
+	p_cell->alert.kind      = direction;
+	p_cell->alert.ticker    = p_entry->ticker;
+	p_cell->alert.field     = p_index->key;
+	p_cell->alert.threshold = p_threshold->threshold;
+	p_cell->alert.previous  = p_index->has_last ? p_index->last : value;
+	p_cell->alert.value     = value;
+	p_cell->alert.context   = p_threshold->context;
+
+	ATOMIC_STORE( &p_cell->sequence, (long) (position + 1) );
+}
+
+/* Takes the oldest fired alert off the queue; FALSE when it is empty. */
+boolean alert_engine_poll( alert_engine_t *p_engine, blp_alert_t *p_alert )
+{
+	unsigned long position;
+	alert_cell_t *p_cell;
+
+	assert( p_engine );
+	assert( p_alert );
+
+	position = (unsigned long) ATOMIC_LOAD( &p_engine->dequeue_position );
+
+	for( ;; )
+	{
+		long difference;
+
+		p_cell     = &p_engine->cells[ position & p_engine->mask ];
+		difference = (long) ((unsigned long) ATOMIC_LOAD( &p_cell->sequence ) - (position + 1));
+
+		if( difference == 0 )
+		{
+			unsigned long claimed = (unsigned long) ATOMIC_COMPARE_EXCHANGE( &p_engine->dequeue_position, (long) (position + 1), (long) position );
+
+			if( claimed == position )
+			{
+				break;
+			}
+
+			position = claimed;
+		}
+		else if( difference < 0 )
+		{
+			return FALSE;
+		}
+		else
+		{
+			position = (unsigned long) ATOMIC_LOAD( &p_engine->dequeue_position );
+		}
+	}
+
+	*p_alert = p_cell->alert;
+
+	/* the cell is free again for the producer one lap ahead */
+	ATOMIC_STORE( &p_cell->sequence, (long) (position + p_engine->mask + 1) );
+	return TRUE;
+}
+
+size_t alert_engine_dropped( const alert_engine_t *p_engine )
+{
+	assert( p_engine );
+	return (size_t) p_engine->dropped;
+}
+
+void arena_initialize( arena_t *p_arena, size_t block_size )
+{
+	p_arena->blocks     = NULL;
+	p_arena->block_size = block_size;
+	p_arena->allocated  = 0;
+}
+
+void* arena_alloc( arena_t *p_arena, size_t size )
+{
+	const size_t header    = ARENA_ALIGN( sizeof(arena_block_t) );
+	arena_block_t *p_block = p_arena->blocks;
+
+	size = ARENA_ALIGN( size );
+
+	if( !p_block || p_block->size - p_block->used < size )
+	{
+		size_t block_size = size > p_arena->block_size ? size : p_arena->block_size;
+
+		p_block = (arena_block_t *) blp_malloc( header + block_size );
+
+		if( !p_block )
+		{
+			return NULL;
+		}
+
+		p_block->next   = p_arena->blocks;
+		p_block->size   = block_size;
+		p_block->used   = 0;
+		p_arena->blocks = p_block;
+	}
+
+	p_block->used      += size;
+	p_arena->allocated += size;
+	return (char *) p_block + header + p_block->used - size;
+}
+
+void arena_destroy( arena_t *p_arena )
+{
+	while( p_arena->blocks )
+	{
+		arena_block_t *p_next = p_arena->blocks->next;
+		blp_free( p_arena->blocks );
+		p_arena->blocks = p_next;
+	}
+
+	p_arena->allocated = 0;
+}
+
+boolean field_initialize( unsigned char type, unsigned char scale, const char *value, field_t *p_field )
+{
+	boolean result = FALSE;
+
+	memset( &p_field->value, 0, sizeof(variant_t) );
+	p_field->type = type;
+
+	/* Fields missing from the dictionary (BLP_FIELD_TYPE_NONE) are kept as strings. */
+	switch( type )
+	{
+		case BLP_FIELD_TYPE_FIXED:
+			result = fixed_conversion( value, scale, p_field );
+			break;
+		case FIELD_TYPE_INTERNED:
+			result = interned_conversion( value, p_field );
+			break;
+		case VARIANT_DECIMAL:
+			result = decimal_conversion( value, &p_field->value );
+			break;
+		case VARIANT_INTEGER:
+			result = integer_conversion( value, &p_field->value );
+			break;
+		case VARIANT_UNSIGNED_INTEGER:
+			result = unsigned_integer_conversion( value, &p_field->value );
+			break;
+		case VARIANT_STRING: /* fall through */
+		default:
+			result = string_conversion( value, p_field );
+			break;
+	}
+
+	return result;
+}
+
+/* Reads a numeric field as a double; integers are widened. */
+boolean field_as_decimal( field_t *p_field, double *p_value )
+{
+	field_resolve( p_field );
+
+	switch( p_field->value.type )
+	{
+		case VARIANT_DECIMAL:
+			*p_value = p_field->value.value.decimal;
+			return TRUE;
+		case VARIANT_INTEGER:
+			*p_value = (double) p_field->value.value.integer;
+			return TRUE;
+		case VARIANT_UNSIGNED_INTEGER:
+			*p_value = (double) p_field->value.value.unsigned_integer;
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+void field_clear_value( field_t *p_field )
+{
+	/* arena strings are reclaimed by compaction */
+	if( variant_is_string( &p_field->value ) && p_field->value_storage == FIELD_STORAGE_HEAP )
+	{
+		blp_free( variant_string( &p_field->value ) );
+	}
+
+	memset( &p_field->value, 0, sizeof(variant_t) );
+	p_field->value_storage = FIELD_STORAGE_HEAP;
+	p_field->code          = BLP_VALUE_CODE_NONE;
+}
+
+boolean field_set_inline_string( field_t *p_field, const char *string, size_t length )
+{
+	if( length >= FIELD_INLINE_CAPACITY )
+	{
+		return FALSE;
+	}
+
+	memcpy( p_field->inline_value, string, length );
+	p_field->inline_value[ length ] = '\0';
+	p_field->value.type             = VARIANT_STRING;
+	p_field->value.value.string     = p_field->inline_value;
+	p_field->value_storage          = FIELD_STORAGE_INLINE;
+	return TRUE;
+}
+
+void field_assign( field_t *p_field, const field_t *p_update )
+{
+	field_clear_value( p_field );
+	p_field->value         = p_update->value;
+	p_field->type          = p_update->type;
+	p_field->scale         = p_update->scale;
+	p_field->fixed         = p_update->fixed;
+	p_field->value_storage = p_update->value_storage;
+	p_field->code          = p_update->code;
+	p_field->is_pending    = FALSE;
+
+	/* an inline string has to point at its new home */
+	if( p_update->value_storage == FIELD_STORAGE_INLINE )
+	{
+		memcpy( p_field->inline_value, p_update->inline_value, FIELD_INLINE_CAPACITY );
+		p_field->value.value.string = p_field->inline_value;
+	}
+}
+
+/*
+ * Checks that a wire string converts to the given type without storing
+ * anything. Numbers are parsed into a scratch value, which needs no
+ * allocation; strings and interned codes are always accepted.
+ */
+boolean field_raw_is_valid( unsigned char type, unsigned char scale, const char *value )
+{
+	long long fixed;
+	double decimal;
+	long integer;
+	unsigned long unsigned_integer;
+
+	switch( type )
+	{
+		case BLP_FIELD_TYPE_FIXED:
+			return parse_fixed( value, scale, &fixed );
+		case VARIANT_DECIMAL:
+			return parse_decimal( value, &decimal );
+		case VARIANT_INTEGER:
+			return parse_integer( value, &integer );
+		case VARIANT_UNSIGNED_INTEGER:
+			return parse_unsigned_integer( value, &unsigned_integer );
+		default:
+			return TRUE;
+	}
+}
+
+boolean field_store_raw( field_t *p_field, unsigned char type, unsigned char scale, const char *value )
+{
+	size_t length = strlen( value ) + 1;
+
+	if( length > p_field->raw_capacity )
+	{
+		size_t capacity = p_field->raw_capacity ? p_field->raw_capacity : 16;
+		char *raw;
+
+		while( capacity < length )
+		{
+			capacity *= 2;
+		}
+
+		raw = (char *) blp_realloc( p_field->raw, capacity );
+
+		if( !raw )
+		{
+			return FALSE;
+		}
+
+		p_field->raw          = raw;
+		p_field->raw_capacity = capacity;
+	}
+
+	memcpy( p_field->raw, value, length );
+	p_field->type       = type;
+	p_field->scale      = scale;
+	p_field->is_pending = TRUE;
+	return TRUE;
+}
+
+void field_resolve( field_t *p_field )
+{
+	field_t update;
+
+	/* caller holds the security lock */
+	if( !p_field->is_pending )
+	{
+		return;
+	}
+
+	p_field->is_pending = FALSE;
+
+	switch( p_field->type )
+	{
+		case FIELD_TYPE_INTERNED:
+		case BLP_FIELD_TYPE_FIXED:
+		case VARIANT_DECIMAL:
+		case VARIANT_INTEGER:
+		case VARIANT_UNSIGNED_INTEGER:
+			memset( &update, 0, sizeof(update) );
+
+			/* numbers were checked when stored; interning can still fail */
+			if( field_initialize( p_field->type, p_field->scale, p_field->raw, &update ) )
+			{
+				field_assign( p_field, &update );
+			}
+			break;
+		default:
+			field_clear_value( p_field );
+			p_field->type = VARIANT_STRING;
+
+			/* Short strings are copied inline and raw is kept for reuse. */
+			if( field_set_inline_string( p_field, p_field->raw, strlen( p_field->raw ) ) )
+			{
+				break;
+			}
+
+			/* Otherwise the raw buffer becomes the string value without a
+			 * copy; the next update starts a new one.
+			 */
+			p_field->value.type         = VARIANT_STRING;
+			p_field->value.value.string = p_field->raw;
+			p_field->raw                = NULL;
+			p_field->raw_capacity       = 0;
+			break;
+	}
+}
+
+/*
+ * Reads the element with the getter matching its wire datatype and stores
+ * the result straight into the variant.  For string-typed fields (and
+ * wire types without a native mapping) *p_string is set to BLPAPI's own
+ * string instead and p_field is left untouched.
+ */
+boolean field_initialize_from_element( unsigned char type, unsigned char scale, const blpapi_Element_t *p_element, field_t *p_field, const char **p_string )
+{
+	variant_t *p_variant = &p_field->value;
+	int datatype         = blpapi_Element_datatype( p_element );
+	const char *value    = NULL;
+
+	*p_string = NULL;
+
+	if( blpapi_Element_isNull( p_element ) )
+	{
+		return FALSE;
+	}
+
+	memset( p_variant, 0, sizeof(variant_t) );
+	p_field->type = type;
+
+	switch( type )
+	{
+		case BLP_FIELD_TYPE_FIXED:
+			switch( datatype )
+			{
+				case BLPAPI_DATATYPE_FLOAT64:
+				case BLPAPI_DATATYPE_FLOAT32:
+				case BLPAPI_DATATYPE_DECIMAL:
+				case BLPAPI_DATATYPE_INT64:
+				case BLPAPI_DATATYPE_INT32:
+				{
+					blpapi_Float64_t decimal;
+
+					if( 0 != blpapi_Element_getValueAsFloat64( p_element, &decimal, 0 ) )
+					{
+						return FALSE;
+					}
+
+					p_field->scale           = scale;
+					p_field->fixed           = fixed_from_decimal( decimal, scale );
+					p_variant->type          = VARIANT_DECIMAL;
+					p_variant->value.decimal = fixed_to_decimal( p_field->fixed, scale );
+					return TRUE;
+				}
+				default:
+					break;
+			}
+			break;
+		case VARIANT_DECIMAL:
+			switch( datatype )
+			{
+				case BLPAPI_DATATYPE_FLOAT64:
+				case BLPAPI_DATATYPE_FLOAT32:
+				case BLPAPI_DATATYPE_DECIMAL:
+				case BLPAPI_DATATYPE_INT64:
+				case BLPAPI_DATATYPE_INT32:
+				{
+					blpapi_Float64_t decimal;
+
+					if( 0 != blpapi_Element_getValueAsFloat64( p_element, &decimal, 0 ) )
+					{
+						return FALSE;
+					}
+
+					p_variant->type          = VARIANT_DECIMAL;
+					p_variant->value.decimal = decimal;
+					return TRUE;
+				}
+				case BLPAPI_DATATYPE_BOOL:
+				{
+					blpapi_Bool_t boolean_value;
+
+					if( 0 != blpapi_Element_getValueAsBool( p_element, &boolean_value, 0 ) )
+					{
+						return FALSE;
+					}
+
+					p_variant->type          = VARIANT_DECIMAL;
+					p_variant->value.decimal = boolean_value ? 1.0 : 0.0;
+					return TRUE;
+				}
+				case BLPAPI_DATATYPE_DATE:
+				case BLPAPI_DATATYPE_TIME:
+				case BLPAPI_DATATYPE_DATETIME:
+				{
+					blpapi_Datetime_t datetime;
+
+					if( 0 != blpapi_Element_getValueAsDatetime( p_element, &datetime, 0 ) )
+					{
+						return FALSE;
+					}
+
+					p_variant->type          = VARIANT_DECIMAL;
+					p_variant->value.decimal = datetime_seconds( &datetime );
+					return TRUE;
+				}
+				default:
+					break;
+			}
+			break;
+		case VARIANT_INTEGER:
+		case VARIANT_UNSIGNED_INTEGER:
+		{
+			blpapi_Int64_t integer;
+
+			switch( datatype )
+			{
+				case BLPAPI_DATATYPE_INT64:
+				case BLPAPI_DATATYPE_INT32:
+				case BLPAPI_DATATYPE_CHAR:
+				case BLPAPI_DATATYPE_BYTE:
+				case BLPAPI_DATATYPE_ENUMERATION:
+					if( 0 != blpapi_Element_getValueAsInt64( p_element, &integer, 0 ) )
+					{
+						return FALSE;
+					}
+					break;
+				case BLPAPI_DATATYPE_FLOAT64:
+				case BLPAPI_DATATYPE_FLOAT32:
+				case BLPAPI_DATATYPE_DECIMAL:
+				{
+					blpapi_Float64_t decimal;
+
+					if( 0 != blpapi_Element_getValueAsFloat64( p_element, &decimal, 0 ) )
+					{
+						return FALSE;
+					}
+
+					integer = (blpapi_Int64_t) decimal;
+					break;
+				}
+				case BLPAPI_DATATYPE_BOOL:
+				{
+					blpapi_Bool_t boolean_value;
+
+					if( 0 != blpapi_Element_getValueAsBool( p_element, &boolean_value, 0 ) )
+					{
+						return FALSE;
+					}
+
+					integer = boolean_value ? 1 : 0;
+					break;
+				}
+				case BLPAPI_DATATYPE_DATE:
+				case BLPAPI_DATATYPE_TIME:
+				case BLPAPI_DATATYPE_DATETIME:
+				{
+					blpapi_Datetime_t datetime;
+
+					if( 0 != blpapi_Element_getValueAsDatetime( p_element, &datetime, 0 ) )
+					{
+						return FALSE;
+					}
+
+					integer = (blpapi_Int64_t) datetime_seconds( &datetime );
+					break;
+				}
+				default:
+					goto string_path;
+			}
+
+			if( type == VARIANT_INTEGER )
+			{
+				p_variant->type          = VARIANT_INTEGER;
+				p_variant->value.integer = (long) integer;
+			}
+			else
+			{
+				p_variant->type                   = VARIANT_UNSIGNED_INTEGER;
+				p_variant->value.unsigned_integer = (unsigned long) integer;
+			}
+			return TRUE;
+		}
+		default:
+			break;
+	}
+
+string_path:
+	/* Strings have to be copied regardless, so let BLPAPI format them. */
+	if( 0 != blpapi_Element_getValueAsString( p_element, &value, 0 ) || !value )
+	{
+		return FALSE;
+	}
+
+	*p_string = value;
+	return TRUE;
+}
+
+/*
+ * Dates and datetimes become seconds since the Unix epoch (UTC when the
+ * offset is known); bare times become seconds since midnight.
+ */
+double datetime_seconds( const blpapi_Datetime_t *p_datetime )
+{
+	double seconds = 0.0;
+
+	if( (p_datetime->parts & BLPAPI_DATETIME_DATE_PART) == BLPAPI_DATETIME_DATE_PART )
+	{
+		/* days from civil date (proleptic Gregorian calendar) */
+		long year           = (long) p_datetime->year - (p_datetime->month <= 2 ? 1 : 0);
+		long era            = (year >= 0 ? year : year - 399) / 400;
+		long year_of_era    = year - era * 400;
+		long month          = p_datetime->month;
+		long day_of_year    = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + p_datetime->day - 1;
+		long day_of_era     = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+		long days           = era * 146097 + day_of_era - 719468;
+
+		seconds = (double) days * 86400.0;
+	}
+
+	if( p_datetime->parts & BLPAPI_DATETIME_HOURS_PART )
+	{
+		seconds += p_datetime->hours * 3600.0;
+	}
+	if( p_datetime->parts & BLPAPI_DATETIME_MINUTES_PART )
+	{
+		seconds += p_datetime->minutes * 60.0;
+	}
+	if( p_datetime->parts & BLPAPI_DATETIME_SECONDS_PART )
+	{
+		seconds += p_datetime->seconds;
+	}
+	if( p_datetime->parts & BLPAPI_DATETIME_MILLISECONDS_PART )
+	{
+		seconds += p_datetime->milliSeconds / 1000.0;
+	}
+	if( p_datetime->parts & BLPAPI_DATETIME_OFFSET_PART )
+	{
+		seconds -= p_datetime->offset * 60.0;
+	}
+
+	return seconds;
+}
+
+/* p_key is a canonical name; a prefix of a mnemonic must not match it. */
+int field_descriptor_compare( const void *p_key, const void *p_descriptor )
+{
+	const char *field                     = (const char *) p_key;
+	const blp_field_descriptor_t *p_right = (const blp_field_descriptor_t *) p_descriptor;
+
+	return strcmp( field, (const char *) &FIELD_MNEMONICS + p_right->mnemonic );
+}
+
+boolean interned_conversion( const char *string, field_t *p_field )
+{
+	blp_value_code_t code;
+	const char *value = value_intern( string, &code );
+
+	if( !value )
+	{
+		return FALSE;
+	}
+
+	p_field->value.type         = VARIANT_STRING;
+	p_field->value.value.string = (char *) value;
+	p_field->value_storage      = FIELD_STORAGE_INTERNED;
+	p_field->code               = code;
+	return TRUE;
+}
+
+boolean string_conversion( const char *string, field_t *p_field )
+{
+	size_t length        = strlen( string );
+	const char* val_copy = NULL;
+	boolean result = FALSE;
+
+	assert( variant_type( &p_field->value ) == VARIANT_NOT_INITIALIZED );
+
+	if( field_set_inline_string( p_field, string, length ) )
+	{
+		return TRUE;
+	}
+
+	val_copy = blp_strdup( string );
+
+	if( !val_copy )
+	{
+		goto done;
+	}
+
+	p_field->value.type         = VARIANT_STRING;
+	p_field->value.value.string = (char *) val_copy;
+	p_field->value_storage      = FIELD_STORAGE_HEAP;
+	result = TRUE;
+
+done:
+	return result;
+}
+
+boolean fixed_conversion( const char *string, unsigned char scale, field_t *p_field )
+{
+	long long value;
+
+	if( p_field && parse_fixed( string, scale, &value ) )
+	{
+		p_field->scale               = scale;
+		p_field->fixed               = value;
+		p_field->value.type          = VARIANT_DECIMAL;
+		p_field->value.value.decimal = fixed_to_decimal( value, scale );
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+boolean decimal_conversion( const char *string, variant_t* p_variant )
+{
+	double value;
+
+	if( p_variant && parse_decimal( string, &value ) )
+	{
+		p_variant->type          = VARIANT_DECIMAL;
+		p_variant->value.decimal = value;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+boolean integer_conversion( const char *string, variant_t* p_variant )
+{
+	long value;
+
+	if( p_variant && parse_integer( string, &value ) )
+	{
+		p_variant->type          = VARIANT_INTEGER;
+		p_variant->value.integer = value;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+boolean unsigned_integer_conversion( const char *string, variant_t* p_variant )
+{
+	unsigned long value;
+
+	if( p_variant && parse_unsigned_integer( string, &value ) )
+	{
+		p_variant->type                   = VARIANT_UNSIGNED_INTEGER;
+		p_variant->value.unsigned_integer = value;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ *   Numeric Parsing
+ *
+ *   These never allocate, never consult the locale on the common path and
+ *   fail on anything that is not entirely a number (e.g. "N.A.") instead
+ *   of quietly yielding zero like atof/atol.
+ */
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PARSE_SWAR  1
+#endif
+
+#define PARSE_MAX_DIGITS   19  /* every 19 digit number fits in 64 bits */
+
+static const double POWERS_OF_TEN[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const unsigned long long INTEGER_POWERS_OF_TEN[] = {
+	1ULL,                10ULL,                 100ULL,                1000ULL,
+	10000ULL,            100000ULL,             1000000ULL,            10000000ULL,
+	100000000ULL,        1000000000ULL,         10000000000ULL,        100000000000ULL,
+	1000000000000ULL,    10000000000000ULL,     100000000000000ULL,    1000000000000000ULL,
+	10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+#if defined(PARSE_SWAR)
+/*
+ * SWAR (SIMD within a register): test and convert eight ASCII digits at
+ * once.  Price fields are short, so this beats setting up SSE registers.
+ */
+static int parse_is_eight_digits( unsigned long long chunk )
+{
+	return (((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+	        (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+static unsigned long long parse_eight_digits( unsigned long long chunk )
+{
+	chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+	chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+	return ((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+#endif
+
+/* Accumulates a run of digits into *p_mantissa; leading zeros are not counted. */
+static const char* parse_digits( const char *p, const char *end, unsigned long long *p_mantissa, int *p_digits )
+{
+	unsigned long long mantissa = *p_mantissa;
+	int digits                  = *p_digits;
+
+	if( mantissa == 0 )
+	{
+		while( p < end && *p == '0' )
+		{
+			p++;
+		}
+	}
+
+	#if defined(PARSE_SWAR)
+	while( end - p >= 8 )
+	{
+		unsigned long long chunk;
+		memcpy( &chunk, p, sizeof(chunk) );
+
+		if( !parse_is_eight_digits( chunk ) )
+		{
+			break;
+		}
+
+		mantissa = mantissa * 100000000ULL + parse_eight_digits( chunk );
+		digits  += 8;
+		p       += 8;
+	}
+	#endif
+
+	while( p < end && *p >= '0' && *p <= '9' )
+	{
+		mantissa = mantissa * 10 + (unsigned long long) (*p - '0');
+		digits  += 1;
+		p++;
+	}
+
+	*p_mantissa = mantissa;
+	*p_digits   = digits;
+	return p;
+}
+
+static const char* parse_skip_space( const char *p, const char *end )
+{
+	while( p < end && (*p == ' ' || *p == '\t') )
+	{
+		p++;
+	}
+
+	return p;
+}
+
+/* Slow path: strtod, with the decimal point translated for the current locale. */
+static boolean parse_decimal_fallback( const char *string, size_t length, double *p_value )
+{
+	const char *point = localeconv( )->decimal_point;
+	char buffer[ 64 ];
+	char *end         = NULL;
+
+	if( point && point[ 0 ] != '.' && point[ 1 ] == '\0' && length < sizeof(buffer) )
+	{
+		size_t i;
+
+		for( i = 0; i <= length; i++ )
+		{
+			buffer[ i ] = string[ i ] == '.' ? point[ 0 ] : string[ i ];
+		}
+
+		string = buffer;
+	}
+
+	*p_value = strtod( string, &end );
+
+	/* out of range values come back as infinity */
+	if( end == string || *p_value != *p_value || *p_value == HUGE_VAL || *p_value == -HUGE_VAL )
+	{
+		return FALSE;
+	}
+
+	end = (char *) parse_skip_space( end, string + length );
+	return end == string + length;
+}
+
+/* Splits a decimal into sign, significant digits and a power of ten. */
+static boolean parse_decimal_scan( const char *string, size_t length, boolean *p_negative, unsigned long long *p_mantissa, int *p_digits, int *p_exponent )
+{
+	const char *end             = string + length;
+	const char *p               = parse_skip_space( string, end );
+	const char *start           = NULL;
+	unsigned long long mantissa = 0;
+	int digits                  = 0;
+	int exponent                = 0;
+	boolean negative            = FALSE;
+
+	if( p < end && (*p == '-' || *p == '+') )
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	start = p;
+	p     = parse_digits( p, end, &mantissa, &digits );
+
+	if( p < end && *p == '.' )
+	{
+		const char *fraction = ++p;
+		p         = parse_digits( p, end, &mantissa, &digits );
+		exponent -= (int) (p - fraction);
+
+		if( p - fraction == 0 && fraction - 1 == start )
+		{
+			return FALSE; /* a lone "." */
+		}
+	}
+
+	if( p == start )
+	{
+		return FALSE;
+	}
+
+	if( p < end && (*p == 'e' || *p == 'E') )
+	{
+		boolean negative_exponent = FALSE;
+		int explicit_exponent     = 0;
+		const char *exponent_start;
+
+		p++;
+		if( p < end && (*p == '-' || *p == '+') )
+		{
+			negative_exponent = (*p == '-');
+			p++;
+		}
+
+		exponent_start = p;
+		while( p < end && *p >= '0' && *p <= '9' )
+		{
+			if( explicit_exponent < 10000 )
+			{
+				explicit_exponent = explicit_exponent * 10 + (*p - '0');
+			}
+			p++;
+		}
+
+		if( p == exponent_start )
+		{
+			return FALSE;
+		}
+
+		exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+	}
+
+	if( parse_skip_space( p, end ) != end )
+	{
+		return FALSE;
+	}
+
+	*p_negative = negative;
+	*p_mantissa = mantissa;
+	*p_digits   = digits;
+	*p_exponent = exponent;
+	return TRUE;
+}
+
+boolean parse_decimal( const char *string, double *p_value )
+{
+	size_t length = strlen( string );
+	unsigned long long mantissa;
+	int digits;
+	int exponent;
+	boolean negative;
+
+	if( !parse_decimal_scan( string, length, &negative, &mantissa, &digits, &exponent ) )
+	{
+		return FALSE;
+	}
+
+	/* Exact whenever the mantissa and the power of ten are both exactly
+	 * representable as doubles (Clinger's fast path).
+	 */
+	if( digits <= PARSE_MAX_DIGITS && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22 )
+	{
+		double value = (double) mantissa;
+
+		value = exponent < 0 ? value / POWERS_OF_TEN[ -exponent ] : value * POWERS_OF_TEN[ exponent ];
+		*p_value = negative ? -value : value;
+		return TRUE;
+	}
+
+	return parse_decimal_fallback( string, length, p_value );
+}
+
+long long fixed_from_decimal( double value, unsigned char scale )
+{
+	double scaled = value * POWERS_OF_TEN[ scale < 22 ? scale : 22 ];
+
+	/* round half away from zero */
+	return (long long) (scaled < 0.0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+double fixed_to_decimal( long long value, unsigned char scale )
+{
+	return (double) value / POWERS_OF_TEN[ scale < 22 ? scale : 22 ];
+}
+
+/* Parses straight into a value scaled by 10^scale, rounding half away from zero. */
+boolean parse_fixed( const char *string, unsigned char scale, long long *p_value )
+{
+	unsigned long long mantissa;
+	int digits;
+	int exponent;
+	boolean negative;
+
+	if( !parse_decimal_scan( string, strlen( string ), &negative, &mantissa, &digits, &exponent ) || digits > PARSE_MAX_DIGITS )
+	{
+		return FALSE;
+	}
+
+	exponent += scale;
+
+	if( mantissa == 0 )
+	{
+		*p_value = 0;
+		return TRUE;
+	}
+	else if( exponent >= 0 )
+	{
+		if( exponent > PARSE_MAX_DIGITS || mantissa > (unsigned long long) LLONG_MAX / INTEGER_POWERS_OF_TEN[ exponent ] )
+		{
+			return FALSE;
+		}
+
+		mantissa *= INTEGER_POWERS_OF_TEN[ exponent ];
+	}
+	else if( -exponent > PARSE_MAX_DIGITS )
+	{
+		mantissa = 0;
+	}
+	else
+	{
+		unsigned long long divisor = INTEGER_POWERS_OF_TEN[ -exponent ];
+		mantissa = (mantissa + divisor / 2) / divisor;
+	}
+
+	if( mantissa > (unsigned long long) LLONG_MAX )
+	{
+		return FALSE;
+	}
+
+	*p_value = negative ? -(long long) mantissa : (long long) mantissa;
+	return TRUE;
+}
+
+boolean parse_integer( const char *string, long *p_value )
+{
+	size_t length               = strlen( string );
+	const char *end             = string + length;
+	const char *p               = parse_skip_space( string, end );
+	const char *start           = NULL;
+	unsigned long long mantissa = 0;
+	unsigned long long limit    = (unsigned long long) LONG_MAX;
+	int digits                  = 0;
+	boolean negative            = FALSE;
+
+	if( p < end && (*p == '-' || *p == '+') )
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	start = p;
+	p     = parse_digits( p, end, &mantissa, &digits );
+
+	if( p == start || parse_skip_space( p, end ) != end )
+	{
+		return FALSE;
+	}
+
+	if( negative )
+	{
+		limit += 1;
+	}
+
+	if( digits > PARSE_MAX_DIGITS || mantissa > limit )
+	{
+		return FALSE;
+	}
+
+	*p_value = negative ? (long) (0 - mantissa) : (long) mantissa;
+	return TRUE;
+}
+
+boolean parse_unsigned_integer( const char *string, unsigned long *p_value )
+{
+	size_t length               = strlen( string );
+	const char *end             = string + length;
+	const char *p               = parse_skip_space( string, end );
+	const char *start           = NULL;
+	unsigned long long mantissa = 0;
+	int digits                  = 0;
+
+	if( p < end && *p == '+' )
+	{
+		p++;
+	}
+
+	start = p;
+
+	while( p < end && *p == '0' )
+	{
+		p++;
+	}
+
+	/* 19 digits always fit, a 20th one (up to ULLONG_MAX) is checked */
+	p = parse_digits( p, end - p > PARSE_MAX_DIGITS ? p + PARSE_MAX_DIGITS : end, &mantissa, &digits );
+
+	if( digits == PARSE_MAX_DIGITS && p < end && *p >= '0' && *p <= '9' )
+	{
+		unsigned long long digit = (unsigned long long) (*p - '0');
+
+		if( mantissa > (ULLONG_MAX - digit) / 10 )
+		{
+			return FALSE;
+		}
+
+		mantissa = mantissa * 10 + digit;
+		p++;
+	}
+
+	if( p == start || parse_skip_space( p, end ) != end )
+	{
+		return FALSE;
+	}
+
+	if( mantissa > (unsigned long long) ULONG_MAX )
+	{
+		return FALSE;
+	}
+
+	*p_value = (unsigned long) mantissa;
+	return TRUE;
+}
+
+/*
+ *   Subscription Object
+ */
+
+/*
+ * A subscription is split into one or more shards.  Each shard owns its
+ * own session (and therefore its own event handler thread) along with
+ * the partition of securities whose tickers hash to it.  Nothing on the
+ * market data path is shared between shards.
+ */
+/*
+ * Built once from the subscribed fields so that market data messages are
+ * decoded by blpapi_Name_t handle rather than by name string.  Names are
+ * interned by BLPAPI, so a message element finds its decoder by hashing
+ * the handle pointer into by_name.  Tables are immutable once published; the ones replaced by subscription_modify()
+ * are kept on the retired list until the subscription is destroyed since
+ * a handler thread may still be walking them.
+ */
+typedef struct field_decoder {
+	blpapi_Name_t* name;
+	blp_field_id_t id;
+	unsigned char  type;
+	unsigned char  scale;
+	const char*    mnemonic;  /* canonical field key */
+} field_decoder_t;
+
+typedef struct decode_table {
+	struct decode_table*    retired;
+	blpapi_Name_t*          market_data_events;
+	const field_decoder_t** by_name;     /* open addressing on the name handle */
+	size_t                  name_mask;
+	size_t                  count;
+	field_decoder_t         decoders[ 1 ];
+} decode_table_t;
+
+struct subscription_shard {
+	subscription_t*           subscription;
+	blpapi_Session_t*         session;
+	blpapi_EventDispatcher_t* dispatcher;
+	const decode_table_t*     decode_table;
+	boolean                   is_terminated;
+	boolean                   is_lazy;
+	boolean                   is_fixed_point;
+	boolean                   use_arena;
+	universe_table_t*         p_universe;
+	alert_engine_t*           p_alerts;
+	tree_map_t                securities;
+
+	#if defined(WIN32) || defined(WIN64)
+    CRITICAL_SECTION crit_section;
+	#endif
+};
 
-		if( p_field )
-		{
-			char *field_copy = strdup(field);
+struct subscription {
+	blp_t*                blp;
+	double                interval;
+	size_t                shard_count;
+	subscription_shard_t* shards;
+	size_t                securities_shard;
+	tree_map_iterator_t   securities_iter;
+	decode_table_t*       decode_table;
 		
-			memset( p_field, 0, sizeof(field_t) );
-
-			if( !field_copy )
-			{
-				free( p_field );
-				result = FALSE;
-				goto done;
-			}
+	blpapi_CorrelationId_t id;
 
-			variant_set_type( &p_field->value, VARIANT_POINTER );
-			p_field->value.value.pointer = value;
+	#if defined(WIN32) || defined(WIN64)
+    CRITICAL_SECTION crit_section;
+	#endif
+};
 
-			result = hash_map_insert( &p_security->fields, field_copy, p_field );
-		}
-	}
+static size_t                ticker_hash                           ( const char *ticker );
+static subscription_shard_t* subscription_shard                    ( const subscription_t *p_subscription, const char *ticker );
+static boolean               subscription_shard_start              ( subscription_shard_t *p_shard, blp_t *p_blp );
+static void                  subscription_shard_stop               ( subscription_shard_t *p_shard );
+static security_t*           subscription_shard_create_security_if_none( subscription_shard_t *p_shard, const char *ticker );
+static decode_table_t*       decode_table_create                   ( const char **fields, size_t number_of_fields );
+static void                  decode_table_destroy                  ( decode_table_t *p_table );
+static const field_decoder_t* decode_table_find                    ( const decode_table_t *p_table, const blpapi_Name_t *name );
+static boolean               subscription_set_decode_table         ( subscription_t *p_subscription, const char **fields, size_t number_of_fields );
+static void                  subscription_cursor_clear             ( subscription_cursor_t *p_cursor );
 
-done:
-	RELEASE_LOCK( p_security );
-	return result;
+subscription_t* subscription_create( void )
+{
+	return subscription_create_sharded( 1 );
 }
 
-boolean security_set_field_from_bb( security_t *p_security, const char *field, const char *value )
+subscription_t* subscription_create_sharded( size_t number_of_shards )
 {
-	boolean result = FALSE;
+	subscription_t *p_subscription = NULL;
+	size_t i;
 
-	ACQUIRE_LOCK( p_security );
-	field_t *p_field = (field_t *) malloc( sizeof(field_t) );
+	if( number_of_shards == 0 )
+	{
+		number_of_shards = 1;
+	}
 
-	assert( p_security );
-	assert( field );
-	assert( value );
+	p_subscription = (subscription_t *) blp_malloc( sizeof(subscription_t) );
 
-	if( p_field )
+	if( !p_subscription )
 	{
-		char *field_copy = strdup(field);
-	
-		memset( p_field, 0, sizeof(field_t) );
+		return NULL;
+	}
 
-		if( !field_copy )
-		{
-			free( p_field );
-			result = FALSE;
-			goto done;
-		}
+	p_subscription->shards = (subscription_shard_t *) blp_malloc( sizeof(subscription_shard_t) * number_of_shards );
 
-		if( !field_initialize( field_copy, value, p_field ) )
-		{
-			free( p_field );
-			free( field_copy );
-			result = FALSE;
-			goto done;
-		}
+	if( !p_subscription->shards )
+	{
+		blp_free( p_subscription );
+		return NULL;
+	}
 
-		/* We have to remove any existing field-value pairs and then insert
-		 * the new one.
-		 */
-		hash_map_remove( &p_security->fields, field_copy );
+	#if defined(WIN32) || defined(WIN64)
+	InitializeCriticalSection( &p_subscription->crit_section );
+	#endif
 
-		result = hash_map_insert( &p_security->fields, field_copy, p_field );
+	ACQUIRE_LOCK( p_subscription );
+	p_subscription->blp              = NULL;
+	p_subscription->interval         = 10;
+	p_subscription->shard_count      = number_of_shards;
+	p_subscription->securities_shard = 0;
+	p_subscription->securities_iter  = NULL;
+	p_subscription->decode_table     = NULL;
+
+	for( i = 0; i < number_of_shards; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+
+		#if defined(WIN32) || defined(WIN64)
+		InitializeCriticalSection( &p_shard->crit_section );
+		#endif
+
+		p_shard->subscription  = p_subscription;
+		p_shard->session       = NULL;
+		p_shard->dispatcher    = NULL;
+		p_shard->decode_table  = NULL;
+		p_shard->is_terminated = FALSE;
+		p_shard->is_lazy        = FALSE;
+		p_shard->is_fixed_point = FALSE;
+		p_shard->use_arena      = FALSE;
+		p_shard->p_universe     = NULL;
+		p_shard->p_alerts       = NULL;
+		tree_map_create( &p_shard->securities, subscription_securities_destroy, (tree_map_compare_function) strcasecmp );
 	}
+	RELEASE_LOCK( p_subscription );
 
-done:
-	RELEASE_LOCK( p_security );
-	return FALSE;
+	return p_subscription;
 }
 
-const char* security_first_field( security_t* p_security )
+void subscription_destroy( subscription_t *p_subscription )
 {
-	const char* result = NULL;
+	size_t i;
 
-	ACQUIRE_LOCK( p_security );
-	hash_map_iterator( &p_security->fields, &p_security->iterator );
+	ACQUIRE_LOCK( p_subscription );
+	assert( p_subscription );
 
-	if( hash_map_iterator_next( &p_security->iterator ) )
+	for( i = 0; i < p_subscription->shard_count; i++ )
 	{
-		result = (const char*) hash_map_iterator_key( &p_security->iterator );
-	}
-	RELEASE_LOCK( p_security );
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
 
-	return result;
-}
+		subscription_shard_stop( p_shard );
 
-const char* security_next_field( security_t* p_security )
-{
-	const char* result = NULL;
+		ACQUIRE_LOCK( p_shard );
+		tree_map_destroy( &p_shard->securities );
+		RELEASE_LOCK( p_shard );
 
-	ACQUIRE_LOCK( p_security );
-	if( hash_map_iterator_next( &p_security->iterator ) )
-	{
-		result = (const char*) hash_map_iterator_key( &p_security->iterator );
+		#if defined(WIN32) || defined(WIN64)
+		DeleteCriticalSection( &p_shard->crit_section );
+		#endif
 	}
-	RELEASE_LOCK( p_security );
 
-	return result;
-}
+	blp_free( p_subscription->shards );
 
-boolean security_add_override( security_t *p_security, const char *field, const char *value )
-{
-	boolean result = FALSE;	
+	while( p_subscription->decode_table )
+	{
+		decode_table_t *p_retired = p_subscription->decode_table->retired;
+		decode_table_destroy( p_subscription->decode_table );
+		p_subscription->decode_table = p_retired;
+	}
+	RELEASE_LOCK( p_subscription );
+	#if defined(WIN32) || defined(WIN64)
+	DeleteCriticalSection( &p_subscription->crit_section );
+	#endif
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	const char *field_copy = _strdup( field );
-	const char *value_copy = _strdup( value );
-	result = tree_map_insert( &p_security->overrides, field_copy, value_copy );
-	RELEASE_LOCK( p_security );
+	#if defined(_DEBUG)
+	memset( p_subscription, 0, sizeof(subscription_t) );
+	#endif
 
-	return result;
+	blp_free( p_subscription );
 }
 
-boolean security_remove_override ( security_t *p_security, const char *field )
+decode_table_t* decode_table_create( const char **fields, size_t number_of_fields )
 {
-	boolean result = FALSE;	
+	decode_table_t *p_table = (decode_table_t *) blp_malloc( sizeof(decode_table_t) + sizeof(field_decoder_t) * number_of_fields );
+	size_t capacity         = 2;
+	size_t i;
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	result = tree_map_remove( &p_security->overrides, field );
-	RELEASE_LOCK( p_security );
+	if( !p_table )
+	{
+		return NULL;
+	}
 
-	return result;
-}
+	while( capacity < 2 * number_of_fields )
+	{
+		capacity *= 2;
+	}
 
-boolean security_has_override( const security_t *p_security, const char *field )
-{
-	boolean result = FALSE;
+	p_table->retired            = NULL;
+	p_table->market_data_events = blpapi_Name_create( "MarketDataEvents" );
+	p_table->by_name            = (const field_decoder_t **) blp_malloc( sizeof(field_decoder_t*) * capacity );
+	p_table->name_mask          = capacity - 1;
+	p_table->count              = 0;
 
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	void *value;
-	result = tree_map_find( &p_security->overrides, field, &value );
-	RELEASE_LOCK( p_security );
+	if( !p_table->by_name )
+	{
+		decode_table_destroy( p_table );
+		return NULL;
+	}
 
-	return result;
-}
+	memset( p_table->by_name, 0, sizeof(field_decoder_t*) * capacity );
 
-void security_clear_overrides( security_t *p_security )
-{
-	ACQUIRE_LOCK( p_security );
-	assert( p_security );
-	tree_map_clear( &p_security->overrides );
-	RELEASE_LOCK( p_security );
-}
+	for( i = 0; i < number_of_fields; i++ )
+	{
+		field_decoder_t *p_decoder = &p_table->decoders[ p_table->count ];
+		const char *field          = fields[ i ];
+		assert( field );
 
-boolean field_initialize( const char *field, const char *value, field_t *p_field )
-{
-	unsigned char field_type;
-	blp_field_descriptor_t *p_field_descriptor;
-	boolean result = FALSE;
+		p_decoder->id = blp_field_id( field );
 
-	blp_field_descriptor_t key;
+		if( p_decoder->id != BLP_FIELD_ID_NONE )
+		{
+			p_decoder->mnemonic = FIELD_MNEMONIC( p_decoder->id );
+			p_decoder->type     = blp_field_type_by_id( p_decoder->id );
+			p_decoder->scale    = FIELDS[ p_decoder->id ].scale;
+		}
+		else
+		{
+			p_decoder->mnemonic = field_key_intern( field );
+			p_decoder->type     = (unsigned char) blp_field_type( field ); /* downloaded dictionary, if any */
+			p_decoder->scale    = 0;
 
-	key.mnemonic    = field;
-	key.type        = 0;
-	key.description = NULL;
+			if( !p_decoder->mnemonic )
+			{
+				decode_table_destroy( p_table );
+				return NULL;
+			}
+		}
 
+		p_decoder->name = blpapi_Name_create( p_decoder->mnemonic );
+		p_table->count++;
 
-	p_field_descriptor = (blp_field_descriptor_t *) bsearch( &key, FIELDS, BLP_FIELD_COUNT, sizeof(blp_field_descriptor_t), field_descriptor_compare );	
+		/* a field subscribed twice keeps its first decoder */
+		if( !decode_table_find( p_table, p_decoder->name ) )
+		{
+			size_t slot = field_key_hash( p_decoder->name ) & p_table->name_mask;
 
-	field_type = VARIANT_STRING;
+			while( p_table->by_name[ slot ] )
+			{
+				slot = (slot + 1) & p_table->name_mask;
+			}
 
-	if( p_field_descriptor )
-	{
-		field_type = p_field_descriptor->type;
+			p_table->by_name[ slot ] = p_decoder;
+		}
 	}
 
-	memset( &p_field->value, 0, sizeof(variant_t) );
+	return p_table;
+}
+
+/* Returns the decoder of a subscribed field, or NULL for any other name. */
+const field_decoder_t* decode_table_find( const decode_table_t *p_table, const blpapi_Name_t *name )
+{
+	size_t slot;
 
-	switch( field_type )
+	for( slot = field_key_hash( name ) & p_table->name_mask; p_table->by_name[ slot ]; slot = (slot + 1) & p_table->name_mask )
 	{
-		case VARIANT_DECIMAL:
-			result = decimal_conversion( value, &p_field->value );
-			break;
-		case VARIANT_INTEGER:
-			result = integer_conversion( value, &p_field->value );
-			break;
-		case VARIANT_UNSIGNED_INTEGER:
-			result = unsigned_integer_conversion( value, &p_field->value );
-			break;
-		case VARIANT_STRING: /* fall through */
-		default:
-			result = string_conversion( value, &p_field->value );
-			break;
+		if( p_table->by_name[ slot ]->name == name )
+		{
+			return p_table->by_name[ slot ];
+		}
 	}
 
-	return result;
+	return NULL;
 }
 
-int field_descriptor_compare( const void *p_left, const void *p_right )
+void decode_table_destroy( decode_table_t *p_table )
 {
-	const blp_field_descriptor_t *p_left_des;
-	const blp_field_descriptor_t *p_right_des;
-	p_left_des  = (blp_field_descriptor_t *) p_left;	
-	p_right_des = (blp_field_descriptor_t *) p_right;	
+	size_t i;
+
+	for( i = 0; i < p_table->count; i++ )
+	{
+		blpapi_Name_destroy( p_table->decoders[ i ].name );
+	}
+
+	if( p_table->by_name )
+	{
+		blp_free( p_table->by_name );
+	}
 
-	return strncmp( p_left_des->mnemonic, p_right_des->mnemonic, strlen(p_right_des->mnemonic) );
+	blpapi_Name_destroy( p_table->market_data_events );
+	blp_free( p_table );
 }
 
-boolean string_conversion( const char *string, variant_t* p_variant )
+boolean subscription_set_decode_table( subscription_t *p_subscription, const char **fields, size_t number_of_fields )
 {
-	const char* val_copy = strdup( string );
-	boolean result = FALSE;
+	decode_table_t *p_table = decode_table_create( fields, number_of_fields );
+	size_t i;
 
-	if( !val_copy )
+	if( !p_table )
 	{
-		goto done;
+		p_subscription->blp->error_num = OutOfMemory;
+		return FALSE;
 	}
 
-	assert( variant_type( p_variant ) == VARIANT_NOT_INITIALIZED );
-
-	if( p_variant )
+	ACQUIRE_LOCK( p_subscription );
+	for( i = 0; i < p_subscription->shard_count; i++ )
 	{
-		p_variant->type         = VARIANT_STRING;
-		p_variant->value.string = (char *) val_copy;
-		result = TRUE;
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+
+		ACQUIRE_LOCK( p_shard );
+		p_shard->decode_table = p_table;
+		RELEASE_LOCK( p_shard );
 	}
 
-done:
-	return result;
+	p_table->retired             = p_subscription->decode_table;
+	p_subscription->decode_table = p_table;
+	RELEASE_LOCK( p_subscription );
+
+	return TRUE;
 }
 
-boolean decimal_conversion( const char *string, variant_t* p_variant )
+size_t ticker_hash( const char *ticker )
 {
-	if( p_variant )
+	/* FNV-1a over the upper-cased ticker; tickers compare case-insensitively
+	 * so "ibm us equity" and "IBM US Equity" must land on the same shard.
+	 */
+	size_t hash = 2166136261u;
+
+	while( *ticker )
 	{
-		p_variant->type          = VARIANT_DECIMAL;
-		p_variant->value.decimal = atof( string );
-		return TRUE;
+		hash ^= (unsigned char) toupper( (unsigned char) *ticker );
+		hash *= 16777619u;
+		ticker++;
 	}
 
-	return FALSE;
+	return hash;
 }
 
-boolean integer_conversion( const char *string, variant_t* p_variant )
+subscription_shard_t* subscription_shard( const subscription_t *p_subscription, const char *ticker )
 {
-	if( p_variant )
-	{
-		p_variant->type          = VARIANT_INTEGER;
-		p_variant->value.integer = atol( string );
-		return TRUE;
-	}
-
-	return FALSE;
+	assert( p_subscription );
+	assert( ticker );
+	return &p_subscription->shards[ ticker_hash( ticker ) % p_subscription->shard_count ];
 }
 
-boolean unsigned_integer_conversion( const char *string, variant_t* p_variant )
+boolean subscription_shard_start( subscription_shard_t *p_shard, blp_t *p_blp )
 {
-	if( p_variant )
+	if( p_shard->session )
 	{
-		p_variant->type                   = VARIANT_UNSIGNED_INTEGER;
-		p_variant->value.unsigned_integer = (unsigned long) atol( string );
 		return TRUE;
 	}
 
-	return FALSE;
-}
+	// Create the shard's own dispatcher pool when one was requested
+	if( p_blp->dispatcher_threads > 0 )
+	{
+		p_shard->dispatcher = blpapi_EventDispatcher_create( p_blp->dispatcher_threads );
 
-/*
- *   Subscription Object
- */
+		if( !p_shard->dispatcher )
+		{
+			p_blp->error_num = FailedToCreateDispatcher;
+			return FALSE;
+		}
 
-struct subscription {
-	blp_t*              blp;
-	blpapi_Session_t*   session;
-	double              interval;
-	boolean             is_terminated;
-	tree_map_iterator_t securities_iter;
-	tree_map_t          securities;
-		
-	blpapi_CorrelationId_t id;
+		if( 0 != blpapi_EventDispatcher_start( p_shard->dispatcher ) )
+		{
+			blpapi_EventDispatcher_destroy( p_shard->dispatcher );
+			p_shard->dispatcher = NULL;
+			p_blp->error_num    = FailedToCreateDispatcher;
+			return FALSE;
+		}
+	}
 
-	#if defined(WIN32) || defined(WIN64)
-    CRITICAL_SECTION crit_section;
-	#endif
-};
+	// Create the session 
+	p_shard->session = blpapi_Session_create( p_blp->session_options, market_data_event_handler, p_shard->dispatcher, p_shard /* user data */ );
+	
+	if( !p_shard->session )
+	{
+		subscription_shard_stop( p_shard );
+		p_blp->error_num = OutOfMemory;
+		return FALSE;
+	}
 
-subscription_t* subscription_create( void )
-{
-	subscription_t *p_subscription = (subscription_t *) malloc( sizeof(subscription_t) );
-	#if defined(WIN32) || defined(WIN64)
-	InitializeCriticalSection( &p_subscription->crit_section );
-	#endif
+	if( 0 != blpapi_Session_start( p_shard->session ) ) // Start a Session
+	{
+		blpapi_Session_destroy( p_shard->session );
+		p_shard->session = NULL;
+		subscription_shard_stop( p_shard );
+		p_blp->error_num = FailedToStartSession;
+		return FALSE;
+	}
 
-	ACQUIRE_LOCK( p_subscription );
-	if( p_subscription )
+	// Open Market Data Service
+	if( 0 != blpapi_Session_openService( p_shard->session, blp_service_name( MarketDataService ) ) )
 	{
-		p_subscription->blp             = NULL;
-		p_subscription->session         = NULL;
-		p_subscription->interval        = 10;
-		p_subscription->is_terminated   = FALSE;
-		p_subscription->securities_iter = NULL;
-		tree_map_create( &p_subscription->securities, subscription_securities_destroy, (tree_map_compare_function) strcasecmp );
+		subscription_shard_stop( p_shard );
+		p_blp->error_num = FailedToOpenService;
+		return FALSE;
 	}
-	RELEASE_LOCK( p_subscription );
 
-	return p_subscription;
+	p_shard->is_terminated = FALSE;
+	return TRUE;
 }
 
-void subscription_destroy( subscription_t *p_subscription )
-{
-	ACQUIRE_LOCK( p_subscription );
-	assert( p_subscription );
-
-	if( p_subscription->session )
+void subscription_shard_stop( subscription_shard_t *p_shard )
+{
+	/* The shard lock must not be held here; stopping the session waits
+	 * for the shard's handler thread which may be blocked on that lock.
+	 */
+	if( p_shard->session )
 	{
-		blpapi_Session_stop( p_subscription->session );
-		blpapi_Session_destroy( p_subscription->session );
+		blpapi_Session_stop( p_shard->session );
+		blpapi_Session_destroy( p_shard->session );
+		p_shard->session = NULL;
 	}
 
-	tree_map_destroy( &p_subscription->securities );
-	RELEASE_LOCK( p_subscription );
-	#if defined(WIN32) || defined(WIN64)
-	DeleteCriticalSection( &p_subscription->crit_section );
-	#endif
-
-	#if defined(_DEBUG)
-	memset( p_subscription, 0, sizeof(subscription_t) );
-	#endif
-
-	free( p_subscription );
+	if( p_shard->dispatcher )
+	{
+		blpapi_EventDispatcher_stop( p_shard->dispatcher, 0 /* synchronous */ );
+		blpapi_EventDispatcher_destroy( p_shard->dispatcher );
+		p_shard->dispatcher = NULL;
+	}
 }
 
 boolean subscription_modify( subscription_t *p_subscription, const char **securities, size_t number_of_securities, const char **fields, size_t number_of_fields )
 {
-	blpapi_Service_t *refDataSvc         = NULL;
-	blpapi_Request_t *p_request          = NULL;
-	blpapi_Element_t *p_elements         = NULL;
-	blpapi_Element_t *p_securities_elems = NULL;
-	blpapi_Element_t *p_field_elems      = NULL;
-	blpapi_Element_t *p_override_elems   = NULL;
-	boolean continue_loop                = TRUE;
+	blpapi_SubscriptionList_t **subscriptions = NULL;
+	size_t number_of_options                  = 1;
+	const char **options                      = NULL;
+	char opts[ 32 ];
 	size_t i;
 
-	if( !p_subscription->blp )
+	if( !p_subscription )
 	{
 		return FALSE;
 	}
 
-	if( !p_subscription )
+	if( !p_subscription->blp )
 	{
 		return FALSE;
 	}
-	else
-	{
-		p_subscription->blp = p_subscription->blp;
-	}
 
-	// Create the session 
-	p_subscription->session = blpapi_Session_create( p_subscription->blp->session_options, market_data_event_handler, NULL, p_subscription /* user data */ );
-	
-	if( !p_subscription->session )
+	if( !subscription_set_decode_table( p_subscription, fields, number_of_fields ) )
 	{
-		p_subscription->blp->error_num = OutOfMemory;
 		return FALSE;
 	}
 
-	if( 0 != blpapi_Session_start( p_subscription->session ) ) // Start a Session
+	subscriptions = (blpapi_SubscriptionList_t **) blp_malloc( sizeof(blpapi_SubscriptionList_t*) * p_subscription->shard_count );
+
+	if( !subscriptions )
 	{
-		blpapi_Session_destroy( p_subscription->session );
-		p_subscription->session = NULL;
-		p_subscription->blp->error_num        = FailedToStartSession;
+		p_subscription->blp->error_num = OutOfMemory;
 		return FALSE;
 	}
 
-	// Open Market Data Service
-	if( 0 != blpapi_Session_openService( p_subscription->session, blp_service_name( MarketDataService ) ) )
+	for( i = 0; i < p_subscription->shard_count; i++ )
 	{
-		blpapi_Session_destroy( p_subscription->session );
-		p_subscription->session = NULL;
-		p_subscription->blp->error_num        = FailedToOpenService;
-		return FALSE;
-	}
+		if( !subscription_shard_start( &p_subscription->shards[ i ], p_subscription->blp ) )
+		{
+			while( i > 0 )
+			{
+				blpapi_SubscriptionList_destroy( subscriptions[ --i ] );
+			}
 
-	// ----------------------------------------------------
-	blpapi_SubscriptionList_t *subscriptions = NULL;
-    char*  security          = NULL;
-    char*  field             = NULL;
-	size_t number_of_options = 1;
+			blp_free( subscriptions );
+			return FALSE;
+		}
 
-	char opts[ 32 ];
+		subscriptions[ i ] = blpapi_SubscriptionList_create( );
+		assert( subscriptions[ i ] );
+	}
 
-	
-	const char **options = (const char **) malloc( sizeof(char*) );
+	options = (const char **) blp_malloc( sizeof(char*) );
 
 #if defined(WIN32) || defined(WIN64)
 	_snprintf_s( opts, sizeof(opts), sizeof(opts) - 1, "interval=%.1lf", p_subscription->interval );
@@ -1191,16 +7400,15 @@ boolean subscription_modify( subscription_t *p_subscription, const char **securi
 
 	options[ 0 ] = opts;
 
-	subscriptions = blpapi_SubscriptionList_create( );
-	assert( subscriptions );
-
-	
 	for( i = 0;	i < number_of_securities; i++ )
 	{
 		const char *ticker = securities[ i ];
+		size_t shard;
 		assert( ticker );
 
-		blpapi_SubscriptionList_add( subscriptions, 
+		shard = ticker_hash( ticker ) % p_subscription->shard_count;
+
+		blpapi_SubscriptionList_add( subscriptions[ shard ], 
 									 ticker, 
 									 &p_subscription->id, 
 									 fields, 
@@ -1209,49 +7417,72 @@ boolean subscription_modify( subscription_t *p_subscription, const char **securi
 									 number_of_options );
     }
 
-	security_t* iter;
-	for( iter = subscription_first_security( p_subscription );
-	     iter != NULL;
-		 iter = subscription_next_security( p_subscription ) )
-	{
-		boolean found = FALSE;
+	blp_free( options );
 
-		for( i = 0; i < number_of_securities; i++ )
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+		const char **stale    = NULL;
+		size_t stale_count    = 0;
+		size_t j;
+
+		ACQUIRE_LOCK( p_shard );
+		stale = (const char **) blp_malloc( sizeof(const char*) * (tree_map_size( &p_shard->securities ) + 1) );
+
+		for( iter = tree_map_begin( &p_shard->securities );
+		     stale && iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
 		{
-			const char *ticker = securities[ i ];
+			const char *ticker = (const char *) iter->key;
+			boolean found      = FALSE;
 
-			if( strcasecmp( ticker, security_ticker(iter) ) == 0 )
+			for( j = 0; j < number_of_securities; j++ )
 			{
-				found = TRUE;
-				break;
+				if( strcasecmp( securities[ j ], ticker ) == 0 )
+				{
+					found = TRUE;
+					break;
+				}
+			}
+
+			if( !found )
+			{
+				stale[ stale_count++ ] = ticker;
 			}
 		}
 
-		if( !found )
+		/* Removal destroys the security (and its ticker), so it happens
+		 * after the walk rather than during it.
+		 */
+		for( j = 0; j < stale_count; j++ )
 		{
-			tree_map_remove( &p_subscription->securities, security_ticker(iter) );
+			tree_map_remove( &p_shard->securities, stale[ j ] );
 		}
-	}
 
-	free( options );
+		blp_free( stale );
+		RELEASE_LOCK( p_shard );
+
+		// Resubscribing to realtime data
+		blpapi_Session_resubscribe( p_shard->session, subscriptions[ i ], NULL, NULL );
 
-	// Resubscribing to realtime data
-	blpapi_Session_resubscribe( p_subscription->session, subscriptions, NULL, NULL );
+		// release subscription list
+		blpapi_SubscriptionList_destroy( subscriptions[ i ] );
+	}
 
-	// release subscription list
-	blpapi_SubscriptionList_destroy( subscriptions );
+	blp_free( subscriptions );
 
 	return TRUE;
 }
 
 boolean subscription_end( subscription_t *p_subscription )
 {
+	size_t i;
+
 	ACQUIRE_LOCK( p_subscription );
-	if( p_subscription->session )
+	for( i = 0; i < p_subscription->shard_count; i++ )
 	{
-		blpapi_Session_stop( p_subscription->session );
-		blpapi_Session_destroy( p_subscription->session );
-		p_subscription->session = NULL;
+		subscription_shard_stop( &p_subscription->shards[ i ] );
 	}
 	RELEASE_LOCK( p_subscription );
 
@@ -1266,14 +7497,28 @@ boolean subscription_securities_destroy( void *p_key, void *p_value )
 	return TRUE;
 }
 
+size_t subscription_shard_count( const subscription_t *p_subscription )
+{
+	assert( p_subscription );
+	return p_subscription->shard_count;
+}
+
 boolean subscription_is_terminated( const subscription_t *p_subscription )
 {
 	boolean result = FALSE;
+	size_t i;
 
-	ACQUIRE_LOCK( p_subscription );
 	assert( p_subscription );
-	result = p_subscription->is_terminated;
-	RELEASE_LOCK( p_subscription );
+
+	/* The logical subscription is broken as soon as any shard loses its session. */
+	for( i = 0; i < p_subscription->shard_count && !result; i++ )
+	{
+		const subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+
+		ACQUIRE_LOCK( p_shard );
+		result = p_shard->is_terminated;
+		RELEASE_LOCK( p_shard );
+	}
 
 	return result;
 }
@@ -1298,16 +7543,155 @@ void subscription_set_interval( subscription_t *p_subscription, double interval
 	RELEASE_LOCK( p_subscription );
 }
 
+void subscription_set_lazy( subscription_t *p_subscription, boolean is_lazy )
+{
+	size_t i;
+
+	assert( p_subscription );
+
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+
+		ACQUIRE_LOCK( p_shard );
+		p_shard->is_lazy = is_lazy;
+
+		for( iter = tree_map_begin( &p_shard->securities );
+		     iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
+		{
+			security_set_lazy( (security_t *) iter->value, is_lazy );
+		}
+		RELEASE_LOCK( p_shard );
+	}
+}
+
+void subscription_set_fixed_point( subscription_t *p_subscription, boolean is_fixed_point )
+{
+	size_t i;
+
+	assert( p_subscription );
+
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+
+		ACQUIRE_LOCK( p_shard );
+		p_shard->is_fixed_point = is_fixed_point;
+
+		for( iter = tree_map_begin( &p_shard->securities );
+		     iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
+		{
+			security_set_fixed_point( (security_t *) iter->value, is_fixed_point );
+		}
+		RELEASE_LOCK( p_shard );
+	}
+}
+
+/*
+ * Applies to securities created from now on, and to existing ones that
+ * have no fields yet (see security_set_arena()).
+ */
+void subscription_set_arena( subscription_t *p_subscription, boolean use_arena )
+{
+	size_t i;
+
+	assert( p_subscription );
+
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+
+		ACQUIRE_LOCK( p_shard );
+		p_shard->use_arena = use_arena;
+
+		for( iter = tree_map_begin( &p_shard->securities );
+		     iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
+		{
+			security_set_arena( (security_t *) iter->value, use_arena );
+		}
+		RELEASE_LOCK( p_shard );
+	}
+}
+
+/*
+ * Feeds a universe table from this subscription's securities, giving
+ * each one a row. Every field write reaches the table, not only market
+ * data: a setter or reference data write publishes its own field along
+ * with the derived fields recomputed from it, so a row never shows a
+ * derived value next to an input it was not computed from. NULL detaches
+ * the current table.
+ */
+void subscription_set_universe( subscription_t *p_subscription, universe_table_t *p_universe )
+{
+	size_t i;
+
+	assert( p_subscription );
+
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+
+		ACQUIRE_LOCK( p_shard );
+		p_shard->p_universe = p_universe;
+
+		for( iter = tree_map_begin( &p_shard->securities );
+		     iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
+		{
+			security_set_universe( (security_t *) iter->value, p_universe );
+		}
+		RELEASE_LOCK( p_shard );
+	}
+}
+
+/*
+ * Feeds an alert engine from this subscription's market data. NULL
+ * detaches the current engine.
+ */
+void subscription_set_alerts( subscription_t *p_subscription, alert_engine_t *p_engine )
+{
+	size_t i;
+
+	assert( p_subscription );
+
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+
+		ACQUIRE_LOCK( p_shard );
+		p_shard->p_alerts = p_engine;
+
+		for( iter = tree_map_begin( &p_shard->securities );
+		     iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
+		{
+			security_set_alerts( (security_t *) iter->value, p_engine );
+		}
+		RELEASE_LOCK( p_shard );
+	}
+}
+
 boolean subscription_has_security( subscription_t *p_subscription, const char *ticker )
 {
+	subscription_shard_t *p_shard = NULL;
 	void *p_security;
 	boolean result = FALSE;
 
-	ACQUIRE_LOCK( p_subscription );
 	assert( p_subscription );
 	assert( ticker );
-	result = tree_map_find( &p_subscription->securities, ticker, &p_security );
-	RELEASE_LOCK( p_subscription );
+	p_shard = subscription_shard( p_subscription, ticker );
+
+	ACQUIRE_LOCK( p_shard );
+	result = tree_map_find( &p_shard->securities, ticker, &p_security );
+	RELEASE_LOCK( p_shard );
 
 	return result;
 }
@@ -1315,62 +7699,110 @@ boolean subscription_has_security( subscription_t *p_subscription, const char *t
 size_t subscription_security_count( const subscription_t* p_subscription )
 {
 	size_t count = 0;
+	size_t i;
 
-	ACQUIRE_LOCK( p_subscription );
 	assert( p_subscription );
-	count = tree_map_size( &p_subscription->securities );
-	RELEASE_LOCK( p_subscription );
+
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		const subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+
+		ACQUIRE_LOCK( p_shard );
+		count += tree_map_size( &p_shard->securities );
+		RELEASE_LOCK( p_shard );
+	}
 
 	return count;
 }
 
 security_t* subscription_security( subscription_t *p_subscription, const char *ticker )
 {
-	security_t *p_security = NULL;
+	subscription_shard_t *p_shard = NULL;
+	security_t *p_security        = NULL;
 	
-	ACQUIRE_LOCK( p_subscription );
 	assert( p_subscription );
 	assert( ticker );
-	if( tree_map_find( &p_subscription->securities, ticker, (void **) &p_security ) )
+	p_shard = subscription_shard( p_subscription, ticker );
+
+	ACQUIRE_LOCK( p_shard );
+	if( tree_map_find( &p_shard->securities, ticker, (void **) &p_security ) )
 	{
 		assert( p_security );
 	}
-	RELEASE_LOCK( p_subscription );
+	RELEASE_LOCK( p_shard );
 
 	return p_security;
 }
 
-security_t* subscription_create_security_if_none( subscription_t *p_subscription, const char *ticker )
+security_t* subscription_shard_create_security_if_none( subscription_shard_t *p_shard, const char *ticker )
 {
 	security_t *p_security;
 
-	ACQUIRE_LOCK( p_subscription );
-	assert( p_subscription );
+	ACQUIRE_LOCK( p_shard );
+	assert( p_shard );
 	assert( ticker );
 
-	if( tree_map_find( &p_subscription->securities, ticker, (void **) &p_security ) )
+	if( tree_map_find( &p_shard->securities, ticker, (void **) &p_security ) )
 	{
 		assert( p_security );
 	}
 	else
 	{
 		p_security = security_create( );
-		p_security->ticker = (char*) ticker; /* memory allocated from the BLPAPI_CORRELATION_TYPE_POINTER */
+		p_security->ticker         = (char*) ticker; /* memory allocated from the BLPAPI_CORRELATION_TYPE_POINTER */
+		p_security->is_lazy        = p_shard->is_lazy;
+		p_security->is_fixed_point = p_shard->is_fixed_point;
+
+		if( p_shard->use_arena )
+		{
+			security_set_arena( p_security, TRUE );
+		}
+
+		if( p_shard->p_universe )
+		{
+			security_set_universe( p_security, p_shard->p_universe );
+		}
+
+		if( p_shard->p_alerts )
+		{
+			security_set_alerts( p_security, p_shard->p_alerts );
+		}
 		
 		/* key is pointer to ticker in security structure. */
-		tree_map_insert( &p_subscription->securities, security_ticker(p_security), p_security );
+		tree_map_insert( &p_shard->securities, security_ticker(p_security), p_security );
 	}
-	RELEASE_LOCK( p_subscription );
+	RELEASE_LOCK( p_shard );
 
 	return p_security;
 }
 
+security_t* subscription_create_security_if_none( subscription_t *p_subscription, const char *ticker )
+{
+	return subscription_shard_create_security_if_none( subscription_shard( p_subscription, ticker ), ticker );
+}
+
 security_t* subscription_first_security( subscription_t* p_subscription )
 {
 	security_t* result = NULL;
+	subscription_shard_t *p_shard;
 
 	ACQUIRE_LOCK( p_subscription );
-	p_subscription->securities_iter = tree_map_begin( &p_subscription->securities );
+	p_subscription->securities_shard = 0;
+	p_shard = &p_subscription->shards[ 0 ];
+
+	ACQUIRE_LOCK( p_shard );
+	p_subscription->securities_iter = tree_map_begin( &p_shard->securities );
+	RELEASE_LOCK( p_shard );
+
+	/* skip over empty shards */
+	while( p_subscription->securities_iter == tree_map_end( ) && ++p_subscription->securities_shard < p_subscription->shard_count )
+	{
+		p_shard = &p_subscription->shards[ p_subscription->securities_shard ];
+
+		ACQUIRE_LOCK( p_shard );
+		p_subscription->securities_iter = tree_map_begin( &p_shard->securities );
+		RELEASE_LOCK( p_shard );
+	}
 
 	if( p_subscription->securities_iter )
 	{
@@ -1384,11 +7816,26 @@ security_t* subscription_first_security( subscription_t* p_subscription )
 security_t* subscription_next_security ( subscription_t* p_subscription )
 {
 	security_t* result = NULL;
+	subscription_shard_t *p_shard;
 	
 	ACQUIRE_LOCK( p_subscription );
-	if( p_subscription->securities_iter != tree_map_end( ) )
+	if( p_subscription->securities_shard < p_subscription->shard_count && p_subscription->securities_iter != tree_map_end( ) )
 	{
+		p_shard = &p_subscription->shards[ p_subscription->securities_shard ];
+
+		ACQUIRE_LOCK( p_shard );
 		p_subscription->securities_iter = tree_map_next( p_subscription->securities_iter );
+		RELEASE_LOCK( p_shard );
+
+		/* continue with the next non-empty shard */
+		while( p_subscription->securities_iter == tree_map_end( ) && ++p_subscription->securities_shard < p_subscription->shard_count )
+		{
+			p_shard = &p_subscription->shards[ p_subscription->securities_shard ];
+
+			ACQUIRE_LOCK( p_shard );
+			p_subscription->securities_iter = tree_map_begin( &p_shard->securities );
+			RELEASE_LOCK( p_shard );
+		}
 
 		if( p_subscription->securities_iter )
 		{
@@ -1401,6 +7848,157 @@ security_t* subscription_next_security ( subscription_t* p_subscription )
 }
 
 
+void subscription_cursor_open( const subscription_t* p_subscription, subscription_cursor_t *p_cursor )
+{
+	assert( p_subscription );
+	assert( p_cursor );
+
+	p_cursor->p_subscription = p_subscription;
+	p_cursor->tickers        = NULL;
+	p_cursor->capacity       = 0;
+	p_cursor->count          = 0;
+	p_cursor->index          = 0;
+	p_cursor->shard          = 0;
+}
+
+/*
+ * Returns the next security, or NULL at the end. Each security is looked
+ * up by ticker under its shard's lock when the cursor reaches it, so one
+ * that a subscription_modify() dropped in the meantime is skipped. The
+ * cursor does not keep the security alive: it must not be used after a
+ * subscription_modify() that drops it.
+ */
+security_t* subscription_cursor_next( subscription_cursor_t *p_cursor )
+{
+	const subscription_t *p_subscription;
+	security_t *p_security = NULL;
+
+	assert( p_cursor );
+	p_subscription = p_cursor->p_subscription;
+
+	while( !p_security )
+	{
+		subscription_shard_t *p_shard;
+
+		/* copy the tickers of the next non-empty shard */
+		while( p_cursor->index == p_cursor->count )
+		{
+			tree_map_iterator_t iter;
+			size_t size;
+
+			subscription_cursor_clear( p_cursor );
+
+			if( p_cursor->shard >= p_subscription->shard_count )
+			{
+				return NULL;
+			}
+
+			p_shard = &p_subscription->shards[ p_cursor->shard++ ];
+
+			ACQUIRE_LOCK( p_shard );
+			size = tree_map_size( &p_shard->securities );
+
+			if( size > p_cursor->capacity )
+			{
+				char **tickers = (char **) blp_realloc( p_cursor->tickers, sizeof(char*) * size );
+
+				if( !tickers )
+				{
+					RELEASE_LOCK( p_shard );
+					return NULL;
+				}
+
+				p_cursor->tickers  = tickers;
+				p_cursor->capacity = size;
+			}
+
+			for( iter = tree_map_begin( &p_shard->securities ); iter != tree_map_end( ); iter = tree_map_next( iter ) )
+			{
+				char *ticker = blp_strdup( (const char *) iter->key );
+
+				if( !ticker )
+				{
+					RELEASE_LOCK( p_shard );
+					return NULL;
+				}
+
+				p_cursor->tickers[ p_cursor->count++ ] = ticker;
+			}
+			RELEASE_LOCK( p_shard );
+		}
+
+		p_shard = &p_subscription->shards[ p_cursor->shard - 1 ];
+
+		ACQUIRE_LOCK( p_shard );
+		if( !tree_map_find( &p_shard->securities, p_cursor->tickers[ p_cursor->index++ ], (void **) &p_security ) )
+		{
+			p_security = NULL;
+		}
+		RELEASE_LOCK( p_shard );
+	}
+
+	return p_security;
+}
+
+/* Frees the tickers copied from the last shard visited. */
+void subscription_cursor_clear( subscription_cursor_t *p_cursor )
+{
+	size_t i;
+
+	for( i = 0; i < p_cursor->count; i++ )
+	{
+		blp_free( p_cursor->tickers[ i ] );
+	}
+
+	p_cursor->count = 0;
+	p_cursor->index = 0;
+}
+
+void subscription_cursor_close( subscription_cursor_t *p_cursor )
+{
+	assert( p_cursor );
+
+	subscription_cursor_clear( p_cursor );
+
+	if( p_cursor->tickers )
+	{
+		blp_free( p_cursor->tickers );
+	}
+
+	p_cursor->tickers  = NULL;
+	p_cursor->capacity = 0;
+}
+
+/*
+ * Calls visitor on every security, one shard at a time with that shard's
+ * lock held, so subscription_modify() cannot drop a security while it is
+ * being visited. It returns FALSE when the visitor stopped the walk.
+ */
+boolean subscription_for_each_security( const subscription_t* p_subscription, subscription_security_visitor visitor, void *context )
+{
+	boolean result = TRUE;
+	size_t i;
+
+	assert( p_subscription );
+	assert( visitor );
+
+	for( i = 0; result && i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+		tree_map_iterator_t iter;
+
+		ACQUIRE_LOCK( p_shard );
+		for( iter = tree_map_begin( &p_shard->securities );
+		     result && iter != tree_map_end( );
+		     iter = tree_map_next( iter ) )
+		{
+			result = visitor( (security_t *) iter->value, context );
+		}
+		RELEASE_LOCK( p_shard );
+	}
+
+	return result;
+}
 
 boolean blp_reference_data( blp_t *p_blp, security_t *p_security, const char *security, size_t number_of_fields, const char **fields )
 {
@@ -1833,22 +8431,24 @@ void handle_reference_data_event( blp_t *p_blp, const blpapi_Event_t *p_event, s
 					else
 					{
 						// read the data for reference field
-						const char *fieldName  = NULL;
-						const char *fieldValue = NULL;
+						const char *fieldName = NULL;
+						blp_field_id_t id;
 
-						fieldName = blpapi_Element_nameString ( field_Element );
-						blpapi_Element_getValueAsString( field_Element, &fieldValue, 0 );
+						fieldName = field_key_intern( blpapi_Element_nameString ( field_Element ) );
+						id        = blp_field_id( fieldName );
 
-						if( !fieldValue )
+						if( !fieldName || !security_set_field_from_element( p_security, fieldName,
+						                                      id != BLP_FIELD_ID_NONE ? blp_field_learn_type( id, field_Element ) : (unsigned char) blp_field_type( fieldName ),
+						                                      id != BLP_FIELD_ID_NONE ? FIELDS[ id ].scale : 0,
+						                                      field_Element ) )
 						{
 							continue;
 						}
 
-						security_set_field_from_bb( p_security, fieldName, fieldValue );
-
 						if( p_blp->debug )
 						{
-							printf( "\t%s = %s\n", fieldName, fieldValue );
+							printf( "\t" );
+							blpapi_Element_print( field_Element, &debug_writer, stdout, 0, -1 );
 						}
 					}
 				}
@@ -1875,6 +8475,339 @@ void handle_reference_data_event( blp_t *p_blp, const blpapi_Event_t *p_event, s
 	blpapi_MessageIterator_destroy( iter );
 }
 
+/*
+ * Downloads every field the API field service knows about and writes it
+ * as a dictionary file for blp_field_dictionary_load().
+ */
+boolean blp_field_dictionary_download( blp_t *p_blp, const char *filename )
+{
+	blpapi_Session_t *p_session  = NULL;
+	blpapi_Service_t *p_service  = NULL;
+	blpapi_Request_t *p_request  = NULL;
+	blpapi_Element_t *p_elements = NULL;
+	boolean continue_loop        = TRUE;
+	boolean result               = FALSE;
+	field_info_list_t list;
+	blpapi_CorrelationId_t correlation_id;
+	size_t i;
+
+	if( !p_blp || !filename )
+	{
+		return FALSE;
+	}
+
+	memset( &list, 0, sizeof(list) );
+
+	p_session = blpapi_Session_create( p_blp->session_options, NULL, NULL, NULL );
+
+	if( !p_session )
+	{
+		p_blp->error_num = OutOfMemory;
+		return FALSE;
+	}
+
+	if( 0 != blpapi_Session_start( p_session ) )
+	{
+		p_blp->error_num = FailedToStartSession;
+		blpapi_Session_destroy( p_session );
+		return FALSE;
+	}
+
+	if( 0 != blpapi_Session_openService( p_session, blp_service_name( APIFieldInformationService ) ) )
+	{
+		blpapi_Session_destroy( p_session );
+		p_blp->error_num = FailedToOpenService;
+		return FALSE;
+	}
+
+	blpapi_Session_getService( p_session, &p_service, blp_service_name( APIFieldInformationService ) );
+
+	blpapi_Service_createRequest( p_service, &p_request, "FieldListRequest" );
+	assert( p_request );
+
+	p_elements = blpapi_Request_elements( p_request );
+	assert( p_elements );
+
+	blpapi_Element_setElementString( p_elements, "fieldType", 0, "All" );
+	blpapi_Element_setElementBool( p_elements, "returnFieldDocumentation", 0, 0 );
+
+	memset( &correlation_id, '\0', sizeof(correlation_id) );
+	correlation_id.size           = sizeof(correlation_id);
+	correlation_id.valueType      = BLPAPI_CORRELATION_TYPE_INT;
+	correlation_id.value.intValue = (blpapi_UInt64_t) 1;
+
+	blpapi_Session_sendRequest( p_session, p_request, &correlation_id, 0, 0, 0, 0 );
+	blpapi_Request_destroy( p_request );
+
+	while( continue_loop )
+	{
+		blpapi_Event_t *p_event = NULL;
+		blpapi_Session_nextEvent( p_session, &p_event, 0 );
+		assert( p_event );
+
+		switch( blpapi_Event_eventType( p_event ) )
+		{
+			case BLPAPI_EVENTTYPE_PARTIAL_RESPONSE:
+				handle_field_list_event( p_blp, p_event, &list );
+				break;
+			case BLPAPI_EVENTTYPE_RESPONSE: /* final event */
+				handle_field_list_event( p_blp, p_event, &list );
+				continue_loop = FALSE;
+				break;
+			default:
+				handle_reference_data_other_event( p_blp, p_event );
+				break;
+		}
+
+		blpapi_Event_release( p_event );
+	}
+
+	blpapi_Session_stop( p_session );
+	blpapi_Session_destroy( p_session );
+
+	if( list.count > 0 )
+	{
+		result = field_dictionary_write( filename, &list );
+	}
+
+	for( i = 0; i < list.count; i++ )
+	{
+		blp_free( list.fields[ i ].mnemonic );
+		blp_free( list.fields[ i ].description );
+	}
+
+	blp_free( list.fields );
+	return result;
+}
+
+void handle_field_list_event( blp_t *p_blp, const blpapi_Event_t *p_event, field_info_list_t *p_list )
+{
+	blpapi_MessageIterator_t *iter = NULL;
+	blpapi_Message_t *message      = NULL;
+
+	assert( p_event );
+	assert( p_list );
+
+	iter = blpapi_MessageIterator_create( p_event );
+	assert( iter );
+
+	while( 0 == blpapi_MessageIterator_next(iter, &message) )
+	{
+		blpapi_Element_t *p_response   = NULL;
+		blpapi_Element_t *p_field_data = NULL;
+		size_t number_of_fields;
+		size_t i;
+
+		assert( message );
+		p_response = blpapi_Message_elements( message );
+
+		if( !p_response || 0 != blpapi_Element_getElement( p_response, &p_field_data, "fieldData", 0 ) )
+		{
+			continue;
+		}
+
+		number_of_fields = blpapi_Element_numValues( p_field_data );
+
+		for( i = 0; i < number_of_fields; i++ )
+		{
+			blpapi_Element_t *p_field        = NULL;
+			blpapi_Element_t *p_field_info   = NULL;
+			const char *mnemonic             = NULL;
+			const char *datatype             = NULL;
+			const char *description          = NULL;
+
+			blpapi_Element_getValueAsElement( p_field_data, &p_field, i );
+
+			// Unknown ids come back with fieldError instead of fieldInfo.
+			if( !p_field || 0 != blpapi_Element_getElement( p_field, &p_field_info, "fieldInfo", 0 ) )
+			{
+				continue;
+			}
+
+			blpapi_Element_getElementAsString( p_field_info, &mnemonic, "mnemonic", 0 );
+			blpapi_Element_getElementAsString( p_field_info, &datatype, "datatype", 0 );
+			blpapi_Element_getElementAsString( p_field_info, &description, "description", 0 );
+
+			if( mnemonic && !field_info_list_add( p_list, mnemonic, datatype, description ) )
+			{
+				p_blp->error_num = OutOfMemory;
+			}
+		}
+	}
+
+	blpapi_MessageIterator_destroy( iter );
+}
+
+boolean field_info_list_add( field_info_list_t *p_list, const char *mnemonic, const char *datatype, const char *description )
+{
+	field_info_t *p_info;
+
+	if( p_list->count == p_list->capacity )
+	{
+		size_t capacity        = p_list->capacity ? 2 * p_list->capacity : 1024;
+		field_info_t *p_fields = (field_info_t *) blp_realloc( p_list->fields, capacity * sizeof(field_info_t) );
+
+		if( !p_fields )
+		{
+			return FALSE;
+		}
+
+		p_list->fields   = p_fields;
+		p_list->capacity = capacity;
+	}
+
+	p_info              = &p_list->fields[ p_list->count ];
+	p_info->mnemonic    = blp_strdup( mnemonic );
+	p_info->description = blp_strdup( description ? description : "" );
+	p_info->type        = BLP_FIELD_TYPE_STRING;
+
+	if( !p_info->mnemonic || !p_info->description )
+	{
+		blp_free( p_info->mnemonic );
+		blp_free( p_info->description );
+		return FALSE;
+	}
+
+	/* Same mapping as for learned types; dates and the rest stay strings. */
+	if( datatype )
+	{
+		if( strcmp( datatype, "Double" ) == 0 || strcmp( datatype, "Float64" ) == 0 ||
+		    strcmp( datatype, "Float32" ) == 0 || strcmp( datatype, "Price" ) == 0 ||
+		    strcmp( datatype, "Int64" ) == 0 )
+		{
+			p_info->type = BLP_FIELD_TYPE_DECIMAL;
+		}
+		else if( strcmp( datatype, "Int32" ) == 0 )
+		{
+			p_info->type = BLP_FIELD_TYPE_INTEGER;
+		}
+	}
+
+	p_list->count++;
+	return TRUE;
+}
+
+int field_info_compare( const void *p_left, const void *p_right )
+{
+	const field_info_t *p_left_info  = (const field_info_t *) p_left;
+	const field_info_t *p_right_info = (const field_info_t *) p_right;
+
+	return strcmp( p_left_info->mnemonic, p_right_info->mnemonic );
+}
+
+boolean field_dictionary_write( const char *filename, field_info_list_t *p_list )
+{
+	field_dictionary_header_t header;
+	char temporary[ 512 ];
+	boolean result      = FALSE;
+	size_t strings_size = 0;
+	size_t count        = 0;
+	FILE *p_file;
+	size_t i;
+
+	if( strlen( filename ) + 5 > sizeof(temporary) )
+	{
+		return FALSE;
+	}
+
+	qsort( p_list->fields, p_list->count, sizeof(field_info_t), field_info_compare );
+
+	/* drop duplicate mnemonics so lookups stay unambiguous */
+	for( i = 0; i < p_list->count; i++ )
+	{
+		if( count > 0 && strcmp( p_list->fields[ count - 1 ].mnemonic, p_list->fields[ i ].mnemonic ) == 0 )
+		{
+			blp_free( p_list->fields[ i ].mnemonic );
+			blp_free( p_list->fields[ i ].description );
+			continue;
+		}
+
+		p_list->fields[ count++ ] = p_list->fields[ i ];
+		strings_size += strlen( p_list->fields[ i ].mnemonic ) + strlen( p_list->fields[ i ].description ) + 2;
+	}
+
+	p_list->count = count;
+
+	if( strings_size > UINT_MAX )
+	{
+		return FALSE;
+	}
+
+	sprintf( temporary, "%s.tmp", filename );
+	p_file = fopen( temporary, "wb" );
+
+	if( !p_file )
+	{
+		return FALSE;
+	}
+
+	memcpy( header.magic, FIELD_DICTIONARY_MAGIC, sizeof(header.magic) );
+	header.version      = FIELD_DICTIONARY_VERSION;
+	header.count        = (unsigned int) count;
+	header.strings_size = (unsigned int) strings_size;
+
+	if( fwrite( &header, sizeof(header), 1, p_file ) != 1 )
+	{
+		goto failed;
+	}
+
+	strings_size = 0;
+
+	for( i = 0; i < count; i++ )
+	{
+		field_dictionary_entry_t entry;
+
+		memset( &entry, 0, sizeof(entry) );
+		entry.mnemonic    = (unsigned int) strings_size;
+		strings_size     += strlen( p_list->fields[ i ].mnemonic ) + 1;
+		entry.description = (unsigned int) strings_size;
+		strings_size     += strlen( p_list->fields[ i ].description ) + 1;
+		entry.type        = p_list->fields[ i ].type;
+
+		if( fwrite( &entry, sizeof(entry), 1, p_file ) != 1 )
+		{
+			goto failed;
+		}
+	}
+
+	for( i = 0; i < count; i++ )
+	{
+		const char *mnemonic    = p_list->fields[ i ].mnemonic;
+		const char *description = p_list->fields[ i ].description;
+
+		if( fwrite( mnemonic, strlen( mnemonic ) + 1, 1, p_file ) != 1 ||
+		    fwrite( description, strlen( description ) + 1, 1, p_file ) != 1 )
+		{
+			goto failed;
+		}
+	}
+
+	if( fclose( p_file ) != 0 )
+	{
+		remove( temporary );
+		return FALSE;
+	}
+
+	/* readers that already mapped the old file keep their view */
+	#if defined(WIN32) || defined(WIN64)
+	result = MoveFileExA( temporary, filename, MOVEFILE_REPLACE_EXISTING ) != 0;
+	#else
+	result = rename( temporary, filename ) == 0;
+	#endif
+
+	if( !result )
+	{
+		remove( temporary );
+	}
+
+	return result;
+
+failed:
+	fclose( p_file );
+	remove( temporary );
+	return FALSE;
+}
+
 void handle_reference_data_other_event( blp_t *p_blp, const blpapi_Event_t *p_event )
 {
 	blpapi_MessageIterator_t *iter = NULL;
@@ -1927,13 +8860,11 @@ boolean blp_market_data( blp_t *p_blp, subscription_t *p_subscription,
 		const char **securities, size_t number_of_securities,
 		const char **fields, size_t number_of_fields )
 {
-	blpapi_Service_t *refDataSvc         = NULL;
-	blpapi_Request_t *p_request          = NULL;
-	blpapi_Element_t *p_elements         = NULL;
-	blpapi_Element_t *p_securities_elems = NULL;
-	blpapi_Element_t *p_field_elems      = NULL;
-	blpapi_Element_t *p_override_elems   = NULL;
-	boolean continue_loop                = TRUE;
+	blpapi_SubscriptionList_t **subscriptions = NULL;
+	size_t *shard_sizes                       = NULL;
+	size_t number_of_options                  = 1;
+	const char **options                      = NULL;
+	char opts[ 32 ];
 	size_t i;
 
 	if( !p_blp )
@@ -1950,42 +8881,31 @@ boolean blp_market_data( blp_t *p_blp, subscription_t *p_subscription,
 		p_subscription->blp = p_blp;
 	}
 
-	// Create the session 
-	p_subscription->session = blpapi_Session_create( p_blp->session_options, market_data_event_handler, NULL, p_subscription /* user data */ );
-	
-	if( !p_subscription->session )
+	if( !subscription_set_decode_table( p_subscription, fields, number_of_fields ) )
 	{
-		p_blp->error_num = OutOfMemory;
 		return FALSE;
 	}
 
-	if( 0 != blpapi_Session_start( p_subscription->session ) ) // Start a Session
-	{
-		blpapi_Session_destroy( p_subscription->session );
-		p_subscription->session = NULL;
-		p_blp->error_num        = FailedToStartSession;
-		return FALSE;
-	}
+	subscriptions = (blpapi_SubscriptionList_t **) blp_malloc( sizeof(blpapi_SubscriptionList_t*) * p_subscription->shard_count );
+	shard_sizes   = (size_t *) blp_malloc( p_subscription->shard_count * sizeof(size_t) );
 
-	// Open Market Data Service
-	if( 0 != blpapi_Session_openService( p_subscription->session, blp_service_name( MarketDataService ) ) )
+	if( !subscriptions || !shard_sizes )
 	{
-		blpapi_Session_destroy( p_subscription->session );
-		p_subscription->session = NULL;
-		p_blp->error_num        = FailedToOpenService;
+		blp_free( subscriptions );
+		blp_free( shard_sizes );
+		p_blp->error_num = OutOfMemory;
 		return FALSE;
 	}
 
-	// ----------------------------------------------------
-	blpapi_SubscriptionList_t *subscriptions = NULL;
-    char*  security          = NULL;
-    char*  field             = NULL;
-	size_t number_of_options = 1;
+	memset( shard_sizes, 0, p_subscription->shard_count * sizeof(size_t) );
 
-	char opts[ 32 ];
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscriptions[ i ] = blpapi_SubscriptionList_create( );
+		assert( subscriptions[ i ] );
+	}
 
-	
-	const char **options = (const char **) malloc( sizeof(char*) );
+	options = (const char **) blp_malloc( sizeof(char*) );
 
 #if defined(WIN32) || defined(WIN64)
 	_snprintf_s( opts, sizeof(opts), sizeof(opts) - 1, "interval=%.1lf", p_subscription->interval );
@@ -1995,14 +8915,15 @@ boolean blp_market_data( blp_t *p_blp, subscription_t *p_subscription,
 
 	options[ 0 ] = opts;
 
-	subscriptions = blpapi_SubscriptionList_create( );
-	assert( subscriptions );
-
+	// Partition the securities across the shards.
 	for( i = 0;	i < number_of_securities; i++ )
 	{
 		const char *ticker = securities[ i ];
+		size_t shard;
 		assert( ticker );
 
+		shard = ticker_hash( ticker ) % p_subscription->shard_count;
+
 		// If security name begins with '/', assuming it is not a ticker
 		// Initialize Correlation object
 		memset( &p_subscription->id, 0, sizeof(p_subscription->id) );
@@ -2010,34 +8931,63 @@ boolean blp_market_data( blp_t *p_blp, subscription_t *p_subscription,
 		//p_subscription->id.valueType              = BLPAPI_CORRELATION_TYPE_INT;
 		//p_subscription->id.value.intValue         = (blpapi_UInt64_t) string_hash( ticker );
 		p_subscription->id.valueType              = BLPAPI_CORRELATION_TYPE_POINTER;
-		p_subscription->id.value.ptrValue.pointer = (void *) strdup( ticker );
+		p_subscription->id.value.ptrValue.pointer = (void *) blp_strdup( ticker );
 
-		blpapi_SubscriptionList_add( subscriptions, 
+		blpapi_SubscriptionList_add( subscriptions[ shard ], 
 									 ticker, 
 									 &p_subscription->id, 
 									 fields, 
 									 options, 
 									 number_of_fields, 
 									 number_of_options );
+		shard_sizes[ shard ]++;
     }
 
-	free( options );
+	blp_free( options );
+
+	// Each shard with securities gets its own session and handler thread.
+	for( i = 0; i < p_subscription->shard_count; i++ )
+	{
+		subscription_shard_t *p_shard = &p_subscription->shards[ i ];
+
+		if( shard_sizes[ i ] > 0 )
+		{
+			if( !subscription_shard_start( p_shard, p_blp ) )
+			{
+				size_t j;
+
+				for( j = i; j < p_subscription->shard_count; j++ )
+				{
+					blpapi_SubscriptionList_destroy( subscriptions[ j ] );
+				}
+
+				blp_free( subscriptions );
+				blp_free( shard_sizes );
+				return FALSE;
+			}
+
+			// Subscribing to realtime data
+			blpapi_Session_subscribe( p_shard->session, subscriptions[ i ], NULL, NULL, NULL );
+		}
 
-	// Subscribing to realtime data
-	blpapi_Session_subscribe( p_subscription->session, subscriptions, NULL, NULL, NULL );
+		// release subscription list
+		blpapi_SubscriptionList_destroy( subscriptions[ i ] );
+	}
 
-	// release subscription list
-	blpapi_SubscriptionList_destroy( subscriptions );
+	blp_free( subscriptions );
+	blp_free( shard_sizes );
 
 	return TRUE;
 }
 
 void market_data_event_handler( blpapi_Event_t *p_event, blpapi_Session_t *p_session, void *user_data )
 {
-	subscription_t *p_subscription = (subscription_t *) user_data;
+	subscription_shard_t *p_shard = (subscription_shard_t *) user_data;
 	assert( p_event );
 	assert( p_session );
-	assert( p_subscription );
+	assert( p_shard );
+
+	dispatcher_thread_pin( p_shard->subscription->blp->dispatcher_affinity );
 
 	switch( blpapi_Event_eventType( p_event ) )
 	{
@@ -2045,25 +8995,46 @@ void market_data_event_handler( blpapi_Event_t *p_event, blpapi_Session_t *p_ses
 		case BLPAPI_EVENTTYPE_SUBSCRIPTION_STATUS:
 			// Process events BLPAPI_EVENTTYPE_SUBSCRIPTION_DATA
 			// & BLPAPI_EVENTTYPE_SUBSCRIPTION_STATUS.
-			handle_market_data_event( p_event, p_session, p_subscription );
+			handle_market_data_event( p_event, p_session, p_shard );
 			break;
 		default:
 			// Process events other than BLPAPI_EVENTTYPE_SUBSCRIPTION_DATA
 			// or BLPAPI_EVENTTYPE_SUBSCRIPTION_STATUS.
-			handle_market_data_other_event( p_event, p_session, p_subscription );
+			handle_market_data_other_event( p_event, p_session, p_shard );
 			break;
 	}
 }
 
-void handle_market_data_event( blpapi_Event_t *p_event, blpapi_Session_t * p_session, subscription_t *p_subscription )
+void handle_market_data_event( blpapi_Event_t *p_event, blpapi_Session_t * p_session, subscription_shard_t *p_shard )
 {
+	subscription_t *p_subscription = p_shard->subscription;
+	const decode_table_t *p_table  = NULL;
 	blpapi_MessageIterator_t *iter = NULL;
 	blpapi_Message_t *p_message = NULL;
     const char *ticker = NULL;
+	staged_field_t local_staged[ STAGED_FIELDS_LOCAL ];
+	staged_field_t *staged = local_staged;
+	size_t staged_capacity = STAGED_FIELDS_LOCAL;
 
 	assert( p_event );
 	assert( p_session );
 
+	ACQUIRE_LOCK( p_shard );
+	p_table = p_shard->decode_table;
+	RELEASE_LOCK( p_shard );
+
+	if( p_table && p_table->count > STAGED_FIELDS_LOCAL )
+	{
+		staged_field_t *p_heap_staged = (staged_field_t *) blp_malloc( sizeof(staged_field_t) * p_table->count );
+
+		/* without memory a message is applied in several batches */
+		if( p_heap_staged )
+		{
+			staged          = p_heap_staged;
+			staged_capacity = p_table->count;
+		}
+	}
+
 	// Event has one or more messages. Create message iterator for event
 	iter = blpapi_MessageIterator_create( p_event );
 	assert( iter );
@@ -2091,23 +9062,48 @@ void handle_market_data_event( blpapi_Event_t *p_event, blpapi_Session_t * p_ses
 
 		if( ticker && p_message_elements )
 		{
-			p_security = subscription_create_security_if_none( p_subscription, ticker );
+			p_security = subscription_shard_create_security_if_none( p_shard, ticker );
 		}
 
-		if( 0 == strcmp( "MarketDataEvents", blpapi_Element_nameString( p_message_elements ) ) )
+		// Names are interned by BLPAPI so the message type is a pointer compare.
+		if( p_security && p_table && blpapi_Message_messageType( p_message ) == p_table->market_data_events )
 		{
-			size_t numItems = blpapi_Element_numElements( p_message_elements );
 			blpapi_Element_t *fieldElement = NULL;
+			size_t element_count           = blpapi_Element_numElements( p_message_elements );
+			size_t staged_count            = 0;
 			size_t i;
 			int dataType;
 
-			for( i = 0; i < numItems; i++ )
+			// Walk the message's own elements once and pick out the
+			// subscribed ones by name handle, rather than searching the
+			// message once per subscribed field.
+			for( i = 0; i < element_count; i++ )
 			{
-				blpapi_Element_getElementAt( p_message_elements, &fieldElement, i );
+				const field_decoder_t *p_decoder;
+				unsigned char type;
+
+				if( 0 != blpapi_Element_getElementAt( p_message_elements, &fieldElement, i ) )
+				{
+					continue;
+				}
+
 				assert( fieldElement );
+				p_decoder = decode_table_find( p_table, blpapi_Element_name( fieldElement ) );
+
+				if( !p_decoder || blpapi_Element_isNull( fieldElement ) )
+				{
+					continue;
+				}
+
+				type = p_decoder->type;
 
 				dataType = blpapi_Element_datatype( fieldElement );
 
+				if( type == BLP_FIELD_TYPE_STRING )
+				{
+					type = blp_field_learn_type( p_decoder->id, fieldElement );
+				}
+
 				if( dataType == BLPAPI_DATATYPE_SEQUENCE )
 				{
 					// read the data for bulk field
@@ -2118,27 +9114,31 @@ void handle_market_data_event( blpapi_Event_t *p_event, blpapi_Session_t * p_ses
 				}
 				else
 				{
-					// read the data for reference field
-					const char *fieldName  = NULL;
-					const char *fieldValue = NULL;
-
-					fieldName = blpapi_Element_nameString( fieldElement );
-					blpapi_Element_getValueAsString( fieldElement, &fieldValue, 0 );
-
-					if( !fieldValue )
+					// stage the data for reference field; the whole
+					// message is published at once below
+					if( !security_stage_field( p_security, &staged[ staged_count ], p_decoder->mnemonic, type, p_decoder->scale, fieldElement ) )
 					{
 						continue;
 					}
 
-					security_set_field_from_bb( p_security, fieldName, fieldValue );
+					if( ++staged_count == staged_capacity )
+					{
+						security_apply_staged( p_security, staged, staged_count );
+						staged_count = 0;
+					}
 
 					if( p_subscription->blp->debug )
 					{
-						printf( "\t%s = %s\n", fieldName, fieldValue );
+						printf( "\t" );
+						blpapi_Element_print( fieldElement, &debug_writer, stdout, 0, -1 );
 					}
 				}
 			}
 
+			if( staged_count > 0 )
+			{
+				security_apply_staged( p_security, staged, staged_count );
+			}
 		}
 	
 		if( p_subscription->blp->debug )
@@ -2150,10 +9150,16 @@ void handle_market_data_event( blpapi_Event_t *p_event, blpapi_Session_t * p_ses
 
 	}
 	blpapi_MessageIterator_destroy(iter);
+
+	if( staged != local_staged )
+	{
+		blp_free( staged );
+	}
 }
 
-void handle_market_data_other_event( blpapi_Event_t *p_event, blpapi_Session_t * p_session, subscription_t *p_subscription )
+void handle_market_data_other_event( blpapi_Event_t *p_event, blpapi_Session_t * p_session, subscription_shard_t *p_shard )
 {
+	subscription_t *p_subscription = p_shard->subscription;
 	blpapi_MessageIterator_t *iter = NULL;
 	blpapi_Message_t *p_message    = NULL;
 
@@ -2188,7 +9194,9 @@ void handle_market_data_other_event( blpapi_Event_t *p_event, blpapi_Session_t *
 			{
 				fprintf( stdout,	"Terminating: %s\n", blpapi_Message_typeString(p_message) );
 			}
-			p_subscription->is_terminated = TRUE;
+			ACQUIRE_LOCK( p_shard );
+			p_shard->is_terminated = TRUE;
+			RELEASE_LOCK( p_shard );
 			break;
 		}
 	}
@@ -25,6 +25,7 @@
 extern "C" {
 #endif
 #include <types.h>
+#include <variant.h>
 	
 #if defined(DLL_EXPORT)
 #define _blplib   __declspec( dllexport )
@@ -42,6 +43,14 @@ extern "C" {
 #define BLP_FIELD_TYPE_INTEGER           (3)
 #define BLP_FIELD_TYPE_UNSIGNED_INTEGER  (4)
 #define BLP_FIELD_TYPE_POINTER           (5)
+#define BLP_FIELD_TYPE_FIXED             (6)
+#define BLP_FIELD_ID_NONE                ((blp_field_id_t) -1)
+#define UNIVERSE_TABLE_NONE              ((size_t) -1)
+#define BLP_ALERT_ID_NONE                (0)
+#define BLP_ALERT_ABOVE                  (1)   /* fires when the value rises through the threshold */
+#define BLP_ALERT_BELOW                  (2)   /* fires when the value falls through the threshold */
+#define BLP_ALERT_CROSSES                (3)   /* fires on either */
+#define BLP_VALUE_CODE_NONE              (0)
 
 
 
@@ -49,23 +58,96 @@ struct blp;
 typedef _blplib struct blp blp_t;
 struct security;
 typedef _blplib struct security security_t;
+struct security_snapshot;
+typedef _blplib struct security_snapshot security_snapshot_t;
+struct universe_table;
+typedef _blplib struct universe_table universe_table_t;
+struct alert_engine;
+typedef _blplib struct alert_engine alert_engine_t;
 struct field;
 typedef _blplib struct field field_t;
 struct subscription;
 typedef _blplib struct subscription subscription_t;
+typedef unsigned int blp_field_id_t;
+typedef unsigned int blp_value_code_t;
+typedef unsigned long long blp_version_t;
+typedef unsigned int blp_alert_id_t;
+typedef void* (*blp_malloc_function)  ( size_t size, void *context );
+typedef void* (*blp_realloc_function) ( void *ptr, size_t size, void *context );
+typedef void  (*blp_free_function)    ( void *ptr, void *context );
+
+/* A fired alert, as returned by alert_engine_poll(). */
+typedef struct blp_alert {
+	blp_alert_id_t id;
+	unsigned char  kind;        /* BLP_ALERT_ABOVE or BLP_ALERT_BELOW: the direction it fired in */
+	const char*    ticker;
+	const char*    field;
+	double         threshold;
+	double         previous;
+	double         value;
+	void*          context;
+} blp_alert_t;
+
+/* Visitors return FALSE to stop the walk early. */
+typedef boolean (*security_field_visitor)       ( const security_t *p_security, const char *field, void *context );
+typedef boolean (*subscription_security_visitor)( security_t *p_security, void *context );
+
+/*
+ * Cursors are owned by the caller, so any number of threads can walk the
+ * same security or subscription at once. A field cursor copies the field
+ * names when it is opened; a subscription cursor copies one shard's
+ * tickers at a time and looks each security up as it reaches it. Close a
+ * cursor to release its memory.
+ */
+typedef struct security_field_cursor {
+	const security_t*     p_security;
+	const char**          fields;
+	size_t                count;
+	size_t                index;
+} security_field_cursor_t;
+
+typedef struct subscription_cursor {
+	const subscription_t* p_subscription;
+	char**                tickers;      /* copied from the last shard visited */
+	size_t                capacity;
+	size_t                count;
+	size_t                index;
+	size_t                shard;
+} subscription_cursor_t;
 
 /*
  *   Bloomberg Library 
  */
 _blplib blp_t*         blp_create                     ( const char *server, short port );
 _blplib void           blp_destroy                    ( blp_t *p_blp );
+_blplib void           blp_set_allocator              ( blp_malloc_function malloc_fn, blp_realloc_function realloc_fn, blp_free_function free_fn, void *context );
 _blplib unsigned short blp_error_code                 ( const blp_t *p_blp );
 _blplib const char*    blp_error                      ( const blp_t *p_blp );
+_blplib boolean        blp_set_dispatcher_threads     ( blp_t *p_blp, size_t number_of_threads );
+_blplib boolean        blp_set_max_event_queue_size   ( blp_t *p_blp, size_t size );
+_blplib boolean        blp_set_slow_consumer_warning  ( blp_t *p_blp, float hi_water_mark, float lo_water_mark );
+_blplib void           blp_set_dispatcher_affinity    ( blp_t *p_blp, unsigned long long cpu_mask );
 _blplib unsigned short blp_field_count                ( void );
+_blplib blp_field_id_t blp_field_id                   ( const char *field );
 _blplib unsigned short blp_field_type                 ( const char *field );
 _blplib const char*    blp_field_description          ( const char *field );
 _blplib const char*    blp_field_mneumonic_by_index   ( size_t index );
 _blplib const char*    blp_field_description_by_index ( size_t index );
+_blplib size_t         blp_field_search               ( const char *prefix, blp_field_id_t *results, size_t max );
+_blplib void           blp_field_registry_clear       ( void );
+_blplib boolean        blp_set_field_interned         ( const char *field, boolean is_interned );
+_blplib blp_value_code_t blp_value_code               ( const char *value );
+_blplib const char*    blp_value_string               ( blp_value_code_t code );
+_blplib boolean        blp_derived_field_add          ( const char *field, const char *expression );
+_blplib boolean        blp_derived_field_remove       ( const char *field );
+_blplib void           blp_derived_field_clear        ( void );
+_blplib size_t         blp_field_search_description   ( const char *text, blp_field_id_t *results, size_t max );
+_blplib void           blp_set_field_type_learning    ( boolean enable );
+_blplib boolean        blp_load_field_types           ( const char *filename );
+_blplib boolean        blp_save_field_types           ( const char *filename );
+_blplib boolean        blp_field_dictionary_download  ( blp_t *p_blp, const char *filename );
+_blplib boolean        blp_field_dictionary_load      ( const char *filename );
+_blplib void           blp_field_dictionary_unload    ( void );
 
 /*
  *   Security Object
@@ -74,6 +156,14 @@ _blplib security_t*      security_create                     ( void );
 _blplib void             security_destroy                    ( security_t *p_security );
 _blplib const char*      security_ticker                     ( const security_t *p_security );
 _blplib boolean          security_set_ticker                 ( security_t *p_security, const char *ticker );
+_blplib void             security_set_lazy                   ( security_t *p_security, boolean is_lazy );
+_blplib boolean          security_is_lazy                    ( const security_t *p_security );
+_blplib void             security_set_fixed_point            ( security_t *p_security, boolean is_fixed_point );
+_blplib boolean          security_is_fixed_point             ( const security_t *p_security );
+_blplib boolean          security_set_arena                  ( security_t *p_security, boolean use_arena );
+_blplib boolean          security_has_arena                  ( const security_t *p_security );
+_blplib boolean          security_set_universe               ( security_t *p_security, universe_table_t *p_universe );
+_blplib boolean          security_set_alerts                 ( security_t *p_security, alert_engine_t *p_engine );
 _blplib boolean          security_has_field                  ( const security_t *p_security, const char *field );
 _blplib size_t           security_field_count                ( const security_t *p_security );
 _blplib unsigned short   security_field_type                 ( const security_t *p_security, const char *field );
@@ -85,30 +175,108 @@ _blplib long             security_field_value_as_integer     ( const security_t
 _blplib boolean          security_set_field_value_as_integer ( security_t *p_security, const char *field, long value );
 _blplib unsigned long    security_field_value_as_uinteger    ( const security_t *p_security, const char *field );
 _blplib boolean          security_set_field_value_as_uinteger( security_t *p_security, const char *field, unsigned long value );
+_blplib long long        security_field_value_as_fixed       ( const security_t *p_security, const char *field );
+_blplib unsigned char    security_field_scale                ( const security_t *p_security, const char *field );
+_blplib blp_value_code_t security_field_value_code           ( const security_t *p_security, const char *field );
+_blplib blp_version_t    security_version                    ( const security_t *p_security );
+_blplib blp_version_t    security_field_version              ( const security_t *p_security, const char *field );
+_blplib size_t           security_changed_fields_since       ( const security_t *p_security, blp_version_t version, const char **fields, size_t max );
+_blplib boolean          security_set_field_value_as_fixed   ( security_t *p_security, const char *field, long long value, unsigned char scale );
+_blplib size_t           security_get_fields                 ( const security_t *p_security, const blp_field_id_t *ids, size_t count, variant_t *values );
+_blplib size_t           security_get_decimals               ( const security_t *p_security, const blp_field_id_t *ids, size_t count, double *values );
 _blplib void*            security_field_value_as_pointer     ( const security_t *p_security, const char *field );
 _blplib boolean          security_set_field_value_as_pointer ( security_t *p_security, const char *field, void* value );
 _blplib const char*      security_first_field                ( security_t* p_security );
 _blplib const char*      security_next_field                 ( security_t* p_security );
+_blplib boolean          security_field_cursor_open          ( const security_t *p_security, security_field_cursor_t *p_cursor );
+_blplib const char*      security_field_cursor_next          ( security_field_cursor_t *p_cursor );
+_blplib void             security_field_cursor_close         ( security_field_cursor_t *p_cursor );
+_blplib boolean          security_for_each_field             ( const security_t *p_security, security_field_visitor visitor, void *context );
 _blplib boolean          security_add_override               ( security_t *p_security, const char *field, const char *value );
 _blplib boolean          security_remove_override            ( security_t *p_security, const char *field );
 _blplib boolean          security_has_override               ( const security_t *p_security, const char *field );
 _blplib void             security_clear_overrides            ( security_t *p_security );
 
+/*
+ *   Security Snapshot
+ */
+_blplib security_snapshot_t* security_snapshot                   ( security_t *p_security );
+_blplib security_snapshot_t* security_snapshot_retain            ( security_snapshot_t *p_snapshot );
+_blplib void                 security_snapshot_release           ( security_snapshot_t *p_snapshot );
+_blplib const char*          security_snapshot_ticker            ( const security_snapshot_t *p_snapshot );
+_blplib blp_version_t        security_snapshot_version           ( const security_snapshot_t *p_snapshot );
+_blplib size_t               security_snapshot_field_count       ( const security_snapshot_t *p_snapshot );
+_blplib const char*          security_snapshot_field_name        ( const security_snapshot_t *p_snapshot, size_t index );
+_blplib boolean              security_snapshot_has_field         ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib unsigned short       security_snapshot_field_type        ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib const char*          security_snapshot_value_as_string   ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib double               security_snapshot_value_as_decimal  ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib long                 security_snapshot_value_as_integer  ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib unsigned long        security_snapshot_value_as_uinteger ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib long long            security_snapshot_value_as_fixed    ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib unsigned char        security_snapshot_scale             ( const security_snapshot_t *p_snapshot, const char *field );
+_blplib void*                security_snapshot_value_as_pointer  ( const security_snapshot_t *p_snapshot, const char *field );
+
+/*
+ *   Universe Table
+ */
+_blplib universe_table_t*    universe_table_create               ( const blp_field_id_t *ids, size_t number_of_columns, size_t row_capacity );
+_blplib void                 universe_table_destroy              ( universe_table_t *p_universe );
+_blplib size_t               universe_table_column_count         ( const universe_table_t *p_universe );
+_blplib size_t               universe_table_row_count            ( const universe_table_t *p_universe );
+_blplib size_t               universe_table_column               ( const universe_table_t *p_universe, blp_field_id_t id );
+_blplib blp_field_id_t       universe_table_column_field         ( const universe_table_t *p_universe, size_t column );
+_blplib const double*        universe_table_values               ( const universe_table_t *p_universe, size_t column );
+_blplib const unsigned char* universe_table_validity             ( const universe_table_t *p_universe, size_t column );
+_blplib boolean              universe_table_is_valid             ( const universe_table_t *p_universe, size_t column, size_t row );
+_blplib const char*          universe_table_ticker               ( const universe_table_t *p_universe, size_t row );
+
+/*
+ *   Column Kernels (validity may be NULL to use every row)
+ */
+_blplib size_t blp_column_count_valid ( const unsigned char *validity, size_t count );
+_blplib double blp_column_sum         ( const double *values, const unsigned char *validity, size_t count );
+_blplib double blp_column_mean        ( const double *values, const unsigned char *validity, size_t count );
+_blplib double blp_column_min         ( const double *values, const unsigned char *validity, size_t count );
+_blplib double blp_column_max         ( const double *values, const unsigned char *validity, size_t count );
+_blplib double blp_column_stddev      ( const double *values, const unsigned char *validity, size_t count );
+
+/*
+ *   Alert Engine
+ */
+_blplib alert_engine_t*      alert_engine_create                 ( size_t queue_capacity );
+_blplib void                 alert_engine_destroy                ( alert_engine_t *p_engine );
+_blplib blp_alert_id_t       alert_engine_add                    ( alert_engine_t *p_engine, const char *ticker, const char *field, unsigned char kind, double threshold, void *context );
+_blplib boolean              alert_engine_remove                 ( alert_engine_t *p_engine, blp_alert_id_t id );
+_blplib boolean              alert_engine_poll                   ( alert_engine_t *p_engine, blp_alert_t *p_alert );
+_blplib size_t               alert_engine_dropped                ( const alert_engine_t *p_engine );
+
 /*
  *   Subscription Object
  */
 _blplib subscription_t*   subscription_create        ( void );
+_blplib subscription_t*   subscription_create_sharded( size_t number_of_shards );
 _blplib void              subscription_destroy       ( subscription_t* p_subscription );
 _blplib boolean           subscription_modify        ( subscription_t *p_subscription, const char **securities, size_t number_of_securities, const char **fields, size_t number_of_fields );
 _blplib boolean           subscription_end           ( subscription_t *p_subscription );
+_blplib size_t            subscription_shard_count   ( const subscription_t* p_subscription );
 _blplib boolean           subscription_is_terminated ( const subscription_t* p_subscription );
 _blplib double            subscription_interval      ( const subscription_t* p_subscription );
 _blplib void              subscription_set_interval  ( subscription_t* p_subscription, double interval );
+_blplib void              subscription_set_lazy      ( subscription_t* p_subscription, boolean is_lazy );
+_blplib void              subscription_set_fixed_point( subscription_t* p_subscription, boolean is_fixed_point );
+_blplib void              subscription_set_arena     ( subscription_t* p_subscription, boolean use_arena );
+_blplib void              subscription_set_universe  ( subscription_t* p_subscription, universe_table_t *p_universe );
+_blplib void              subscription_set_alerts    ( subscription_t* p_subscription, alert_engine_t *p_engine );
 _blplib boolean           subscription_has_security  ( subscription_t* p_subscription, const char *ticker );
 _blplib size_t            subscription_security_count( const subscription_t* p_subscription );
 _blplib security_t*       subscription_security      ( subscription_t* p_subscription, const char *ticker );
 _blplib security_t*       subscription_first_security( subscription_t* p_subscription );
 _blplib security_t*       subscription_next_security ( subscription_t* p_subscription );
+_blplib void              subscription_cursor_open   ( const subscription_t* p_subscription, subscription_cursor_t *p_cursor );
+_blplib security_t*       subscription_cursor_next   ( subscription_cursor_t *p_cursor );
+_blplib void              subscription_cursor_close  ( subscription_cursor_t *p_cursor );
+_blplib boolean           subscription_for_each_security( const subscription_t* p_subscription, subscription_security_visitor visitor, void *context );
 
 /*
  *   Bloomberg Services
@@ -0,0 +1,137 @@
+/*
+ * Round trip of the downloaded field dictionary: the fields of a made-up
+ * FieldListResponse are written the way blp_field_dictionary_download()
+ * writes them, loaded back and looked up. A file whose entries are out
+ * of order has to be rejected.
+ *
+ * The test includes the library source to reach the writer, e.g.
+ *     cl /I.. field_dictionary_test.c blpapi3_32.lib libcollections.lib
+ */
+#include "../libblp.c"
+
+#define TEST_DICTIONARY  "field_dictionary_test.dat"
+
+/* mnemonic, datatype and description as a fieldInfo element carries them */
+static const char *response[][ 3 ] = {
+	{ "ZZ_TEST_VOLUME",   "Int64",    "Test volume" },
+	{ "ZZ_TEST_CODE",     "String",   "Test code" },
+	{ "PX_LAST",          "Int32",    "Last price" },
+	{ "ZZ_TEST_COUNT",    "Int32",    "Test count" },
+	{ "ZZ_TEST_PRICE",    "Price",    "Test price" },
+	{ "ZZ_TEST_VOLUME",   "Int64",    "Test volume" },   /* duplicates are dropped */
+	{ "ZZ_TEST_DATE",     "Date",     "Test date" }
+};
+
+#define RESPONSE_COUNT  (sizeof(response) / sizeof(response[0]))
+
+static int failures = 0;
+
+static void check( boolean condition, const char *what )
+{
+	if( !condition )
+	{
+		printf( "failed: %s\n", what );
+		failures++;
+	}
+}
+
+static boolean check_type( const char *field, unsigned short type )
+{
+	return blp_field_type( field ) == type;
+}
+
+static boolean check_description( const char *field, const char *description )
+{
+	const char *actual = blp_field_description( field );
+
+	return actual && strcmp( actual, description ) == 0;
+}
+
+/* Rewrites the dictionary with its first two entries swapped. */
+static boolean write_unsorted( const char *filename )
+{
+	FILE *file   = fopen( filename, "rb" );
+	char *buffer = NULL;
+	long size    = 0;
+	boolean result = FALSE;
+	field_dictionary_entry_t *entries;
+	field_dictionary_entry_t swap;
+
+	if( !file || fseek( file, 0, SEEK_END ) != 0 || (size = ftell( file )) <= 0 || fseek( file, 0, SEEK_SET ) != 0 )
+	{
+		goto done;
+	}
+
+	buffer = (char *) malloc( (size_t) size );
+
+	if( !buffer || fread( buffer, 1, (size_t) size, file ) != (size_t) size )
+	{
+		goto done;
+	}
+
+	fclose( file );
+	file = NULL;
+
+	entries      = (field_dictionary_entry_t *) (buffer + sizeof(field_dictionary_header_t));
+	swap         = entries[ 0 ];
+	entries[ 0 ] = entries[ 1 ];
+	entries[ 1 ] = swap;
+
+	file   = fopen( filename, "wb" );
+	result = file && fwrite( buffer, 1, (size_t) size, file ) == (size_t) size;
+
+done:
+	if( file )
+	{
+		fclose( file );
+	}
+
+	free( buffer );
+	return result;
+}
+
+int main( void )
+{
+	field_info_list_t list;
+	size_t i;
+
+	memset( &list, 0, sizeof(list) );
+
+	for( i = 0; i < RESPONSE_COUNT; i++ )
+	{
+		field_info_list_add( &list, response[ i ][ 0 ], response[ i ][ 1 ], response[ i ][ 2 ] );
+	}
+
+	check( field_dictionary_write( TEST_DICTIONARY, &list ), "write" );
+	check( blp_field_description( "ZZ_TEST_PRICE" ) == NULL, "unknown before load" );
+	check( blp_field_dictionary_load( TEST_DICTIONARY ), "load" );
+
+	check( check_type( "ZZ_TEST_VOLUME", BLP_FIELD_TYPE_DECIMAL ), "Int64 type" );
+	check( check_type( "ZZ_TEST_CODE", BLP_FIELD_TYPE_STRING ), "String type" );
+	check( check_type( "ZZ_TEST_COUNT", BLP_FIELD_TYPE_INTEGER ), "Int32 type" );
+	check( check_type( "zz_test_price", BLP_FIELD_TYPE_DECIMAL ), "Price type, any case" );
+	check( check_type( "ZZ_TEST_DATE", BLP_FIELD_TYPE_STRING ), "Date type" );
+	check( check_type( "PX_LAST", BLP_FIELD_TYPE_INTEGER ), "compiled field retyped" );
+	check( check_description( "ZZ_TEST_VOLUME", "Test volume" ), "description" );
+	check( check_description( "ZZ_TEST_DATE", "Test date" ), "last description" );
+	check( blp_field_description( "ZZ_TEST_MISSING" ) == NULL, "missing field" );
+
+	blp_field_dictionary_unload( );
+
+	check( write_unsorted( TEST_DICTIONARY ), "rewrite" );
+	check( !blp_field_dictionary_load( TEST_DICTIONARY ), "unsorted file rejected" );
+	check( blp_field_description( "ZZ_TEST_VOLUME" ) == NULL, "nothing loaded" );
+
+	remove( TEST_DICTIONARY );
+
+	for( i = 0; i < list.count; i++ )
+	{
+		blp_free( list.fields[ i ].mnemonic );
+		blp_free( list.fields[ i ].description );
+	}
+
+	blp_free( list.fields );
+
+	printf( "field_dictionary_test: %s\n", failures ? "FAILED" : "passed" );
+	return failures ? 1 : 0;
+}
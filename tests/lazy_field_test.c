@@ -0,0 +1,57 @@
+/*
+ * A market data value that fails to parse has to be rejected the same way
+ * whether the security converts on write or lazily on read: the field keeps
+ * the last good value written, and a field that never had one is not
+ * created.
+ *
+ * The test includes the library source to reach the wire setter, e.g.
+ *     cl /I.. lazy_field_test.c blpapi3_32.lib libcollections.lib
+ */
+#include "../libblp.c"
+
+static int failures = 0;
+
+static void check( boolean condition, const char *mode, const char *what )
+{
+	if( !condition )
+	{
+		printf( "failed (%s): %s\n", mode, what );
+		failures++;
+	}
+}
+
+static void run( boolean is_lazy )
+{
+	const char *mode       = is_lazy ? "lazy" : "eager";
+	const char *bid        = field_key_intern( "BID" );
+	const char *ask        = field_key_intern( "ASK" );
+	security_t *p_security = security_create( );
+	blp_version_t version;
+
+	security_set_lazy( p_security, is_lazy );
+
+	check( security_set_field_from_bb( p_security, bid, VARIANT_DECIMAL, 0, "10.5" ), mode, "first value is stored" );
+	check( security_field_value_as_decimal( p_security, "BID" ) == 10.5, mode, "first value is read" );
+	check( security_set_field_from_bb( p_security, bid, VARIANT_DECIMAL, 0, "11.5" ), mode, "second value is stored" );
+
+	version = security_version( p_security );
+	check( !security_set_field_from_bb( p_security, bid, VARIANT_DECIMAL, 0, "N.A." ), mode, "unparsable value is rejected" );
+	check( security_field_value_as_decimal( p_security, "BID" ) == 11.5, mode, "last written value survives" );
+	check( security_version( p_security ) == version, mode, "rejected value leaves the version alone" );
+
+	/* an unparsable first value creates nothing */
+	check( !security_set_field_from_bb( p_security, ask, VARIANT_DECIMAL, 0, "N.A." ), mode, "unparsable first value is rejected" );
+	check( !security_has_field( p_security, "ASK" ), mode, "no field for a rejected first value" );
+	check( security_version( p_security ) == version, mode, "rejected first value leaves the version alone" );
+
+	security_destroy( p_security );
+}
+
+int main( void )
+{
+	run( FALSE );
+	run( TRUE );
+
+	printf( "lazy_field_test: %s\n", failures ? "FAILED" : "passed" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Reads short string fields back from a snapshot. Short strings are kept
+ * inline in each snapshot entry, so they have to survive the entries being
+ * sorted by key when the snapshot is built.
+ *
+ * Build it against the library, e.g. cl /I.. snapshot_test.c libblp.lib
+ */
+#include <stdio.h>
+#include <string.h>
+#include "../libblp.h"
+
+static const char *fields[] = { "TICKER", "NAME", "CRNCY", "EXCH_CODE", "COUNTRY_ISO", "SECURITY_TYP", "MARKET_SECTOR_DES", "ID_ISIN" };
+static const char *values[] = { "IBM", "IBM CORP", "USD", "US", "US", "Common Stock", "Equity", "US4592001014" };
+
+#define FIELD_COUNT  (sizeof(fields) / sizeof(fields[0]))
+
+static int check_snapshot( security_snapshot_t *p_snapshot, const char *name_value )
+{
+	int failures = 0;
+	size_t i;
+
+	for( i = 0; i < FIELD_COUNT; i++ )
+	{
+		const char *expected = i == 1 ? name_value : values[ i ];
+		const char *actual   = security_snapshot_value_as_string( p_snapshot, fields[ i ] );
+
+		if( !actual || strcmp( actual, expected ) != 0 )
+		{
+			printf( "%s: expected \"%s\", got \"%s\"\n", fields[ i ], expected, actual ? actual : "(null)" );
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+int main( void )
+{
+	security_t *p_security = security_create( );
+	security_snapshot_t *p_first;
+	security_snapshot_t *p_second;
+	int failures = 0;
+	size_t i;
+
+	security_set_ticker( p_security, "IBM US Equity" );
+
+	for( i = 0; i < FIELD_COUNT; i++ )
+	{
+		security_set_field_value_as_string( p_security, fields[ i ], values[ i ] );
+	}
+
+	p_first   = security_snapshot( p_security );
+	failures += check_snapshot( p_first, "IBM CORP" );
+
+	/* a new snapshot after an update, while the first is still held */
+	security_set_field_value_as_string( p_security, "NAME", "INTL BUSINESS MACHINES" );
+	p_second  = security_snapshot( p_security );
+	failures += check_snapshot( p_second, "INTL BUSINESS MACHINES" );
+	failures += check_snapshot( p_first, "IBM CORP" );
+
+	security_snapshot_release( p_second );
+	security_snapshot_release( p_first );
+	security_destroy( p_security );
+
+	printf( "snapshot_test: %s\n", failures ? "FAILED" : "passed" );
+	return failures ? 1 : 0;
+}